@@ -2,7 +2,10 @@
 #include <vector>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <map>
+#include <set>
+#include <queue>
 #include <ctime>
 #include <sstream>
 #include <iomanip>
@@ -11,8 +14,33 @@
 #include <cstdlib>
 #include <functional>
 #include <limits>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HS_HAVE_MMAP 1
+#else
+#define HS_HAVE_MMAP 0
+#endif
 using namespace std;
 
+// Instrumentation is compiled in by default; build with -DHS_METRICS=0 to remove it
+#ifndef HS_METRICS
+#define HS_METRICS 1
+#endif
+
 // Forward declarations
 class HospitalSystem;
 class User;
@@ -20,6 +48,7 @@ class Doctor;
 class Patient;
 class Admin;
 class Appointment;
+class MappedStore;
 
 // Global instance
 extern HospitalSystem *g_HospitalSystemInstance;
@@ -32,6 +61,626 @@ string hashPassword(const string &password)
     return to_string(hasher(password));
 }
 
+// Broken-down local time. localtime() shares one static buffer, and notification
+// workers format times while the main thread does, so use the reentrant forms.
+tm localTime(time_t when)
+{
+    tm result = {};
+#ifdef _WIN32
+    localtime_s(&result, &when);
+#else
+    localtime_r(&when, &result);
+#endif
+    return result;
+}
+
+// Local time as "YYYY-MM-DD HH:MM"
+string currentDateTime()
+{
+    tm now = localTime(time(0));
+    char dt[20];
+    strftime(dt, sizeof(dt), "%Y-%m-%d %H:%M", &now);
+    return dt;
+}
+
+// Slot length and working hours are fixed at compile time; override with e.g.
+// -DHS_SLOT_MINUTES=15 -DHS_OPEN_HOUR=7 -DHS_CLOSE_HOUR=19
+#ifndef HS_SLOT_MINUTES
+#define HS_SLOT_MINUTES 30
+#endif
+#ifndef HS_OPEN_HOUR
+#define HS_OPEN_HOUR 8
+#endif
+#ifndef HS_CLOSE_HOUR
+#define HS_CLOSE_HOUR 17
+#endif
+
+// Hours during which appointments can be booked or offered
+struct WorkingHours
+{
+    int openMinute;  // Minute of the day the first slot starts
+    int closeMinute; // Minute of the day the last slot must have ended
+    unsigned days;   // Bit 0 = Monday ... bit 6 = Sunday
+};
+
+constexpr int SLOT_MINUTES = HS_SLOT_MINUTES;
+constexpr int MINUTES_PER_DAY = 24 * 60;
+constexpr WorkingHours HOSPITAL_HOURS = {HS_OPEN_HOUR * 60, HS_CLOSE_HOUR * 60, 0x7F};
+
+static_assert(SLOT_MINUTES > 0 && MINUTES_PER_DAY % SLOT_MINUTES == 0, "slot length must divide a day");
+static_assert(0 <= HOSPITAL_HOURS.openMinute && HOSPITAL_HOURS.openMinute < HOSPITAL_HOURS.closeMinute &&
+                  HOSPITAL_HOURS.closeMinute <= MINUTES_PER_DAY,
+              "working hours must lie within one day");
+static_assert(HOSPITAL_HOURS.openMinute % SLOT_MINUTES == 0 && HOSPITAL_HOURS.closeMinute % SLOT_MINUTES == 0,
+              "working hours must start and end on slot boundaries");
+
+constexpr int32_t floorDiv(int32_t a, int32_t b)
+{
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+constexpr bool isLeapYear(int year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+constexpr int daysInMonth(int year, int month)
+{
+    return month == 2 ? (isLeapYear(year) ? 29 : 28) : (month == 4 || month == 6 || month == 9 || month == 11) ? 30 : 31;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+constexpr int32_t daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+struct CivilDate
+{
+    int year, month, day;
+};
+
+constexpr CivilDate civilFromDays(int32_t days)
+{
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    int dayOfEra = days - era * 146097;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int mp = (5 * dayOfYear + 2) / 153;
+    int month = mp < 10 ? mp + 3 : mp - 9;
+    return {yearOfEra + era * 400 + (month <= 2), month, dayOfYear - (153 * mp + 2) / 5 + 1};
+}
+
+// An appointment time as whole minutes since 1970-01-01 00:00 local time.
+// All comparisons, bucketing and slot arithmetic are plain integer operations;
+// text only appears when parsing input and formatting output.
+struct SlotTime
+{
+    static constexpr int32_t INVALID = numeric_limits<int32_t>::min();
+    static constexpr int MAX_YEAR = 6052; // Later years overflow int32 minutes
+    int32_t minutes = INVALID;
+
+    static constexpr SlotTime fromCivil(int year, int month, int day, int hour, int minute)
+    {
+        return {daysFromCivil(year, month, day) * MINUTES_PER_DAY + hour * 60 + minute};
+    }
+
+    constexpr bool valid() const { return minutes != INVALID; }
+    constexpr int32_t day() const { return floorDiv(minutes, MINUTES_PER_DAY); }
+    constexpr int minuteOfDay() const { return minutes - day() * MINUTES_PER_DAY; }
+    constexpr int weekday() const { return (day() % 7 + 10) % 7; } // 0 = Monday; 1970-01-01 was a Thursday
+    constexpr int32_t slot() const { return floorDiv(minutes, SLOT_MINUTES); }
+    constexpr bool onSlotBoundary() const { return minutes % SLOT_MINUTES == 0; }
+
+    // Months since year 0, for comparing and grouping by calendar month
+    constexpr int32_t month() const
+    {
+        CivilDate date = civilFromDays(day());
+        return date.year * 12 + date.month - 1;
+    }
+
+    // A bookable slot starts on a slot boundary and ends within working hours on a working day
+    constexpr bool isBookable() const
+    {
+        return valid() && onSlotBoundary() && (HOSPITAL_HOURS.days >> weekday() & 1) &&
+               minuteOfDay() >= HOSPITAL_HOURS.openMinute &&
+               minuteOfDay() + SLOT_MINUTES <= HOSPITAL_HOURS.closeMinute;
+    }
+
+    constexpr bool operator==(SlotTime other) const { return minutes == other.minutes; }
+    constexpr bool operator!=(SlotTime other) const { return minutes != other.minutes; }
+    constexpr bool operator<(SlotTime other) const { return minutes < other.minutes; }
+    constexpr bool operator<=(SlotTime other) const { return minutes <= other.minutes; }
+    constexpr bool operator>(SlotTime other) const { return minutes > other.minutes; }
+    constexpr bool operator>=(SlotTime other) const { return minutes >= other.minutes; }
+};
+
+// Parses "YYYY-M-D H:MM"; zero padding is optional and 'T' may separate date and time.
+// Anything else, including impossible dates, gives an invalid SlotTime.
+constexpr SlotTime parseDateTime(string_view text)
+{
+    size_t pos = 0;
+    auto number = [&](size_t minDigits, size_t maxDigits, int &value)
+    {
+        size_t start = pos;
+        value = 0;
+        while (pos < text.size() && pos - start < maxDigits && text[pos] >= '0' && text[pos] <= '9')
+        {
+            value = value * 10 + (text[pos++] - '0');
+        }
+        return pos - start >= minDigits;
+    };
+    auto expect = [&](char c1, char c2)
+    {
+        if (pos < text.size() && (text[pos] == c1 || text[pos] == c2))
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    };
+
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0;
+    if (!number(4, 4, year) || !expect('-', '-') || !number(1, 2, month) || !expect('-', '-') ||
+        !number(1, 2, day) || !expect(' ', 'T') || !number(1, 2, hour) || !expect(':', ':') ||
+        !number(2, 2, minute) || pos != text.size())
+        return {};
+    if (year > SlotTime::MAX_YEAR || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month) || hour > 23 || minute > 59)
+        return {};
+    return SlotTime::fromCivil(year, month, day, hour, minute);
+}
+
+static_assert(parseDateTime("2025-4-5 9:00") == parseDateTime("2025-04-05 09:00"), "padding is optional");
+static_assert(parseDateTime("2025-04-05T09:00") == parseDateTime("2025-04-05 09:00"), "ISO 'T' separator");
+static_assert(parseDateTime("1970-01-01 00:30").minutes == 30, "epoch is 1970-01-01 00:00");
+static_assert(parseDateTime("2024-02-29 10:00").valid() && !parseDateTime("2025-02-29 10:00").valid(), "leap years");
+static_assert(!parseDateTime("2025-04-05 24:00").valid() && !parseDateTime("2025-04-05 9:5").valid(), "bad times");
+static_assert(!parseDateTime("2025-04-05 09:00 ").valid() && !parseDateTime("").valid(), "trailing text");
+static_assert(parseDateTime("2025-04-07 00:00").weekday() == 0, "2025-04-07 was a Monday");
+static_assert(civilFromDays(parseDateTime("2000-02-29 12:00").day()).day == 29, "round trip");
+static_assert((int64_t)daysFromCivil(SlotTime::MAX_YEAR + 1, 1, 1) * MINUTES_PER_DAY - 1 < numeric_limits<int32_t>::max() &&
+                  (int64_t)daysFromCivil(SlotTime::MAX_YEAR + 2, 1, 1) * MINUTES_PER_DAY > numeric_limits<int32_t>::max(),
+              "MAX_YEAR is the last year int32 minutes can hold");
+static_assert(parseDateTime("6052-12-31 23:59").valid() && !parseDateTime("9999-12-31 10:00").valid(), "year range");
+
+// Writes "YYYY-MM-DD HH:MM" (16 characters, no terminator)
+inline void formatDateTime(SlotTime time, char *out)
+{
+    CivilDate date = civilFromDays(time.day());
+    int minuteOfDay = time.minuteOfDay();
+    auto two = [](char *p, int v)
+    {
+        p[0] = char('0' + v / 10);
+        p[1] = char('0' + v % 10);
+    };
+    two(out, date.year / 100 % 100);
+    two(out + 2, date.year % 100);
+    out[4] = '-';
+    two(out + 5, date.month);
+    out[7] = '-';
+    two(out + 8, date.day);
+    out[10] = ' ';
+    two(out + 11, minuteOfDay / 60);
+    out[13] = ':';
+    two(out + 14, minuteOfDay % 60);
+}
+
+string formatDateTime(SlotTime time)
+{
+    if (!time.valid())
+        return "invalid";
+    char text[16];
+    formatDateTime(time, text);
+    return string(text, sizeof(text));
+}
+
+// "YYYY-MM" for a value of SlotTime::month()
+string formatMonth(int32_t month)
+{
+    string text = formatDateTime(SlotTime::fromCivil(month / 12, month % 12 + 1, 1, 0, 0));
+    return text.substr(0, 7);
+}
+
+ostream &operator<<(ostream &out, SlotTime time)
+{
+    return out << formatDateTime(time);
+}
+
+// Local time truncated to the minute
+SlotTime currentSlotTime()
+{
+    tm now = localTime(time(0));
+    return SlotTime::fromCivil(now.tm_year + 1900, now.tm_mon + 1, now.tm_mday, now.tm_hour, now.tm_min);
+}
+
+#if HS_METRICS
+// Scoped timers and counters. Every thread records into its own slots without
+// contention; slots from all threads are merged only when a snapshot is exported.
+class Metrics
+{
+public:
+    enum Kind
+    {
+        COUNTER,
+        TIMER,
+        GAUGE
+    };
+    static const int MAX_METRICS = 64;
+    static const int BUCKETS = 32; // Bucket i holds durations below 2^i microseconds
+
+    // Per-thread storage; only the owning thread writes, exporters read
+    struct ThreadSlots
+    {
+        atomic<uint64_t> counters[MAX_METRICS] = {};
+        atomic<uint64_t> buckets[MAX_METRICS][BUCKETS] = {};
+        atomic<uint64_t> sumNanos[MAX_METRICS] = {};
+    };
+
+    static int registerMetric(const char *name, Kind kind)
+    {
+        lock_guard<mutex> lock(registryMutex());
+        vector<pair<string, Kind>> &names = metricNames();
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (names[i].first == name)
+                return (int)i;
+        }
+        if (names.size() >= MAX_METRICS)
+            return -1;
+        names.push_back({name, kind});
+        return (int)names.size() - 1;
+    }
+
+    static void add(int id, uint64_t amount)
+    {
+        if (id < 0)
+            return;
+        bump(localSlots().counters[id], amount);
+    }
+
+    // Gauges hold a single current value shared by all threads
+    static void set(int id, int64_t value)
+    {
+        if (id < 0)
+            return;
+        gauges()[id].store(value, memory_order_relaxed);
+    }
+
+    static void record(int id, uint64_t nanos)
+    {
+        if (id < 0)
+            return;
+        ThreadSlots &slots = localSlots();
+        int bucket = 0;
+        for (uint64_t micros = nanos / 1000; micros > 0 && bucket < BUCKETS - 1; micros >>= 1)
+            bucket++;
+        bump(slots.buckets[id][bucket], 1);
+        bump(slots.sumNanos[id], nanos);
+    }
+
+    // Prometheus text exposition of all metrics, merged across threads
+    static void writePrometheus(ostream &out)
+    {
+        lock_guard<mutex> lock(registryMutex());
+        const vector<pair<string, Kind>> &names = metricNames();
+        for (size_t id = 0; id < names.size(); id++)
+        {
+            const string &name = names[id].first;
+            if (names[id].second == COUNTER)
+            {
+                uint64_t total = 0;
+                for (const auto &slots : allSlots())
+                    total += slots->counters[id].load(memory_order_relaxed);
+                out << "# TYPE hs_" << name << "_total counter\n";
+                out << "hs_" << name << "_total " << total << "\n";
+                continue;
+            }
+            if (names[id].second == GAUGE)
+            {
+                out << "# TYPE hs_" << name << " gauge\n";
+                out << "hs_" << name << " " << gauges()[id].load(memory_order_relaxed) << "\n";
+                continue;
+            }
+
+            uint64_t buckets[BUCKETS] = {}, sumNanos = 0, count = 0;
+            for (const auto &slots : allSlots())
+            {
+                for (int b = 0; b < BUCKETS; b++)
+                    buckets[b] += slots->buckets[id][b].load(memory_order_relaxed);
+                sumNanos += slots->sumNanos[id].load(memory_order_relaxed);
+            }
+            out << "# TYPE hs_" << name << "_seconds histogram\n";
+            for (int b = 0; b < BUCKETS; b++)
+            {
+                count += buckets[b];
+                if (b < BUCKETS - 1)
+                    out << "hs_" << name << "_seconds_bucket{le=\"" << (double)(1ULL << b) / 1e6 << "\"} " << count << "\n";
+            }
+            out << "hs_" << name << "_seconds_bucket{le=\"+Inf\"} " << count << "\n";
+            out << "hs_" << name << "_seconds_sum " << sumNanos / 1e9 << "\n";
+            out << "hs_" << name << "_seconds_count " << count << "\n";
+        }
+    }
+
+private:
+    static void bump(atomic<uint64_t> &value, uint64_t amount)
+    {
+        // Single writer per slot, so a plain load/store avoids a locked add
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    static mutex &registryMutex()
+    {
+        static mutex m;
+        return m;
+    }
+    static atomic<int64_t> *gauges()
+    {
+        static atomic<int64_t> values[MAX_METRICS] = {};
+        return values;
+    }
+    static vector<pair<string, Kind>> &metricNames()
+    {
+        static vector<pair<string, Kind>> names;
+        return names;
+    }
+    // Slots outlive their threads so samples from finished threads are still exported
+    static vector<shared_ptr<ThreadSlots>> &allSlots()
+    {
+        static vector<shared_ptr<ThreadSlots>> slots;
+        return slots;
+    }
+    static ThreadSlots &localSlots()
+    {
+        thread_local ThreadSlots *local = nullptr;
+        if (!local)
+        {
+            auto slots = make_shared<ThreadSlots>();
+            lock_guard<mutex> lock(registryMutex());
+            allSlots().push_back(slots);
+            local = slots.get();
+        }
+        return *local;
+    }
+};
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(int id) : id(id), start(chrono::steady_clock::now()) {}
+    ~ScopedTimer()
+    {
+        Metrics::record(id, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    int id;
+    chrono::steady_clock::time_point start;
+};
+
+#define HS_METRIC_JOIN2(a, b) a##b
+#define HS_METRIC_JOIN(a, b) HS_METRIC_JOIN2(a, b)
+// Times the rest of the enclosing scope
+#define METRIC_TIMER(name)                                                                                   \
+    static const int HS_METRIC_JOIN(metricId_, __LINE__) = Metrics::registerMetric(name, Metrics::TIMER); \
+    ScopedTimer HS_METRIC_JOIN(metricTimer_, __LINE__)(HS_METRIC_JOIN(metricId_, __LINE__))
+#define METRIC_COUNT(name, amount)                                                     \
+    do                                                                                 \
+    {                                                                                  \
+        static const int metricId_ = Metrics::registerMetric(name, Metrics::COUNTER); \
+        Metrics::add(metricId_, amount);                                               \
+    } while (0)
+#define METRIC_GAUGE(name, value)                                                    \
+    do                                                                               \
+    {                                                                                \
+        static const int metricId_ = Metrics::registerMetric(name, Metrics::GAUGE); \
+        Metrics::set(metricId_, value);                                              \
+    } while (0)
+// Records a duration measured elsewhere, e.g. time spent waiting in a queue
+#define METRIC_OBSERVE(name, nanos)                                                  \
+    do                                                                               \
+    {                                                                                \
+        static const int metricId_ = Metrics::registerMetric(name, Metrics::TIMER); \
+        Metrics::record(metricId_, nanos);                                           \
+    } while (0)
+#else
+#define METRIC_TIMER(name) ((void)0)
+#define METRIC_COUNT(name, amount) ((void)0)
+#define METRIC_GAUGE(name, value) ((void)0)
+#define METRIC_OBSERVE(name, nanos) ((void)0)
+#endif
+
+// A patient-facing event: booking, cancellation, reschedule or emergency change
+struct Notification
+{
+    string patientID;
+    string event; // "booked", "cancelled", "rescheduled", "moved-earlier", "emergency-cancelled", ...
+    string apptID;
+    SlotTime dateTime;
+    chrono::steady_clock::time_point queuedAt;
+};
+
+// Receives the notifications for one patient, already coalesced into a batch.
+// Called from worker threads, possibly concurrently.
+class NotificationSink
+{
+public:
+    virtual ~NotificationSink() {}
+    virtual void deliver(const string &patientID, const vector<Notification> &batch) = 0;
+};
+
+// Appends one line per delivered batch to a local file
+class FileNotificationSink : public NotificationSink
+{
+public:
+    explicit FileNotificationSink(const string &path) : out(path, ios::app) {}
+
+    void deliver(const string &patientID, const vector<Notification> &batch) override
+    {
+        string line = currentDateTime() + " | Patient: " + patientID + " | " + to_string(batch.size()) + " update(s):";
+        for (const auto &note : batch)
+        {
+            line += " " + note.event + " " + note.apptID + " " + formatDateTime(note.dateTime) + ";";
+        }
+        lock_guard<mutex> lock(writeMutex);
+        out << line << '\n';
+        out.flush();
+    }
+
+private:
+    mutex writeMutex;
+    ofstream out;
+};
+
+// Bounded queues drained by worker threads. publish() never waits for delivery:
+// when a queue is full the notification is dropped and counted instead.
+// Patients are sharded across the workers, one queue each, so all of a patient's
+// events pass through one worker and reach the sink in publish order.
+class NotificationService
+{
+public:
+    NotificationService(NotificationSink &sink, size_t capacity = 10000, int workerCount = 2, size_t maxBatch = 256)
+        : sink(sink), maxBatch(maxBatch)
+    {
+        workerCount = max(workerCount, 1);
+        for (int i = 0; i < workerCount; i++)
+        {
+            shards.emplace_back(new Shard);
+            shards.back()->capacity = max<size_t>(1, (capacity + workerCount - 1) / workerCount);
+        }
+    }
+    ~NotificationService() { stop(); }
+
+    void start()
+    {
+        for (auto &shard : shards)
+        {
+            lock_guard<mutex> lock(shard->queueMutex);
+            shard->stopping = false;
+            shard->worker = thread(&NotificationService::drain, this, shard.get());
+        }
+    }
+
+    // Delivers everything still queued, then joins the workers
+    void stop()
+    {
+        for (auto &shard : shards)
+        {
+            {
+                lock_guard<mutex> lock(shard->queueMutex);
+                shard->stopping = true;
+            }
+            shard->wake.notify_all();
+        }
+        for (auto &shard : shards)
+        {
+            if (shard->worker.joinable())
+                shard->worker.join();
+        }
+    }
+
+    bool publish(Notification note)
+    {
+        note.queuedAt = chrono::steady_clock::now();
+        Shard &shard = *shards[hash<string>()(note.patientID) % shards.size()];
+        {
+            lock_guard<mutex> lock(shard.queueMutex);
+            if (shard.queue.size() >= shard.capacity)
+            {
+                dropped++;
+                METRIC_COUNT("notifications_dropped", 1);
+                return false;
+            }
+            shard.queue.push_back(move(note));
+            published++;
+            queued++;
+        }
+        METRIC_GAUGE("notification_queue_depth", queued.load());
+        METRIC_COUNT("notifications_published", 1);
+        shard.wake.notify_one();
+        return true;
+    }
+
+    size_t depth()
+    {
+        return (size_t)max<int64_t>(queued, 0);
+    }
+
+    atomic<uint64_t> published{0};
+    atomic<uint64_t> dropped{0};
+    atomic<uint64_t> delivered{0};
+
+private:
+    struct Shard
+    {
+        mutex queueMutex;
+        condition_variable wake;
+        deque<Notification> queue;
+        size_t capacity = 0;
+        bool stopping = false;
+        thread worker;
+    };
+
+    void drain(Shard *shard)
+    {
+        vector<Notification> batch;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(shard->queueMutex);
+                shard->wake.wait(lock, [shard]()
+                                 { return shard->stopping || !shard->queue.empty(); });
+                if (shard->queue.empty())
+                {
+                    return; // Stopping and fully drained
+                }
+                size_t take = min(maxBatch, shard->queue.size());
+                batch.assign(make_move_iterator(shard->queue.begin()), make_move_iterator(shard->queue.begin() + take));
+                shard->queue.erase(shard->queue.begin(), shard->queue.begin() + take);
+            }
+            queued -= (int64_t)batch.size();
+            METRIC_GAUGE("notification_queue_depth", queued.load());
+
+            // Coalesce per patient, keeping each patient's events in order
+            map<string, vector<Notification>> byPatient;
+            for (auto &note : batch)
+            {
+                byPatient[note.patientID].push_back(move(note));
+            }
+            for (const auto &entry : byPatient)
+            {
+                sink.deliver(entry.first, entry.second);
+            }
+
+#if HS_METRICS
+            // Latency from publish to handoff to the sink
+            auto now = chrono::steady_clock::now();
+            for (const auto &entry : byPatient)
+            {
+                for (const auto &note : entry.second)
+                {
+                    METRIC_OBSERVE("notification_latency", chrono::duration_cast<chrono::nanoseconds>(now - note.queuedAt).count());
+                }
+            }
+#endif
+            delivered += batch.size();
+            METRIC_COUNT("notification_batches", byPatient.size());
+            batch.clear();
+        }
+    }
+
+    NotificationSink &sink;
+    size_t maxBatch;
+    vector<unique_ptr<Shard>> shards;
+    atomic<int64_t> queued{0}; // Across all shards
+};
+
 // Appointment class definition
 class Appointment
 {
@@ -39,12 +688,16 @@ public:
     string apptID;
     string doctorID;
     string patientID;
-    string dateTime; // ISO 8601 format
-    string status;   // "scheduled", "completed", "cancelled", "emergency-cancelled"
+    SlotTime dateTime;
+    string status; // "scheduled", "completed", "cancelled", "emergency-cancelled"
     bool isEmergency = false;
 
     void reschedule();
     void cancel(string reason);
+    bool occupiesSlot() const
+    {
+        return status == "scheduled" || status == "completed";
+    }
     void display() const
     {
         cout << "Appointment ID: " << apptID << ", Doctor: " << doctorID
@@ -53,16 +706,112 @@ public:
     }
 };
 
+// A free slot offered by a specialization search
+struct SlotOffer
+{
+    string doctorID;
+    SlotTime dateTime;
+};
+
+// Appointment counts by status, as shown in the system report
+struct AppointmentStats
+{
+    int total = 0;
+    int scheduled = 0;
+    int completed = 0;
+    int cancelled = 0;
+    int emergency = 0;
+
+    void count(const Appointment &appt)
+    {
+        total++;
+        if (appt.status == "scheduled")
+            scheduled++;
+        if (appt.status == "completed")
+            completed++;
+        if (appt.status == "cancelled" || appt.status == "patient-cancelled" ||
+            appt.status == "emergency-cancelled")
+            cancelled++;
+        if (appt.isEmergency)
+            emergency++;
+    }
+};
+
+// One sealed archive file holding closed appointments of a single month.
+// Segments are written once and never modified; a month may have several.
+struct ArchiveSegment
+{
+    string month; // "YYYY-MM"
+    string file;  // Relative to the archive directory
+    AppointmentStats stats;
+    uint64_t idCeiling = 0; // One past the largest appointment number in the segment
+};
+
+// A patient's booking and the month it was for, which narrows the search once it is archived
+struct AppointmentRef
+{
+    string apptID;
+    int32_t month; // SlotTime::month() when booked
+};
+
+// A patient waiting for an earlier slot with a doctor
+struct WaitlistEntry
+{
+    string patientID;
+    string apptID; // Appointment to move earlier; empty if the patient has none yet
+};
+
+// Waitlist key for patients without an appointment; sorts after every real time
+constexpr SlotTime WAITLIST_ANY_TIME = {numeric_limits<int32_t>::max()};
+
 // HospitalSystem class definition
 class HospitalSystem
 {
 public:
     vector<Doctor> doctors;
     vector<Patient> patients;
-    vector<Appointment> appointments;
+    vector<Appointment> appointments; // Hot window: months not yet sealed into the archive
     vector<Admin> admins;
     static HospitalSystem *instance;
 
+    // Closed months live in immutable archive segments and are read only on demand
+    vector<ArchiveSegment> archiveCatalog;
+    map<string, vector<Appointment>> loadedArchives; // month -> rows, for recently used months only
+    deque<string> archiveCacheOrder;                 // Months in loadedArchives, least recently used first
+    size_t archiveCacheMonths = 2;                   // Most months loadedArchives holds
+    int32_t sealedThrough = -1;                      // Latest sealed SlotTime::month(), -1 if none
+    uint64_t archivedIDCeiling = 0;                  // New appointment numbers start here, above every sealed one
+    int archiveGraceMonths = 1;                      // Ended months that stay hot before sealing
+
+    // Lookup indexes, rebuilt by rebuildIndexes() and kept current by the mutators below
+    map<string, size_t> doctorIndex;                 // doctorID -> position in doctors
+    map<string, size_t> patientIndex;                // patientID -> position in patients
+    map<string, size_t> appointmentIndex;            // apptID -> position in appointments
+    map<string, vector<size_t>> patientAppointments; // patientID -> positions in appointments
+    map<string, vector<size_t>> specializationIndex; // specialization -> positions in doctors
+    map<string, multiset<int32_t>> bookedSlots;      // doctorID -> SlotTime::slot() held by scheduled/completed appointments
+
+    // Per-doctor waitlists keyed by the time each patient holds now, so the patient
+    // who gains most from an opening is always last
+    typedef multimap<SlotTime, WaitlistEntry> Waitlist;
+    map<string, Waitlist> waitlists;                                // doctorID -> waitlist
+    map<string, pair<string, Waitlist::iterator>> waitlistByAppt; // apptID -> (doctorID, entry)
+
+    // Audit log is kept open; batch runs turn off per-line flushing and flush once at the end
+    ofstream auditFile;
+    bool auditAutoFlush = true;
+
+    string dataDir; // Prefix for data files; empty means the working directory
+
+    ostream *statusOut = &cout; // Progress and warnings; batch runs send them to cerr
+
+    NotificationService *notifier = nullptr; // Optional; events are dropped when unset
+    void notify(const Appointment &appt, string event);
+
+    MappedStore *mappedStore = nullptr; // Optional memory-mapped live state
+    void persistAppointment(const Appointment &appt);
+    void persistUser(const User &user);
+
     HospitalSystem()
     {
         instance = this;
@@ -71,13 +820,58 @@ public:
 
     void loadFromFile();
     void saveToFile();
-    void backupData();
+    void readRecordFiles();
+    void writeRecordFiles();
+    int quarantined = 0;       // Rows set aside by the current load
+    set<string> quarantineRows; // quarantine.txt as of the first row set aside; cleared after each load
+    ofstream quarantineFile;    // Open for appending while a load sets rows aside
+    void quarantine(const string &source, const string &row);
+    void saveAppointments();
+    string backupData();
     void logAudit(string action, string userID);
+    bool exportMetrics(ostream *dump);
     Appointment *findAppointment(string apptID);
+    bool isSlotAvailable(string doctorID, SlotTime dateTime);
     bool isSlotAvailable(string doctorID, string dateTime);
     User *authenticateUser(string userID, string password);
     Doctor *findDoctor(string doctorID);
     Patient *findPatient(string patientID);
+
+    void rebuildIndexes();
+    bool registerDoctor(const Doctor &doctor);
+    bool registerPatient(const Patient &patient);
+    void addAppointment(const Appointment &appt);
+    string generateAppointmentID(string prefix);
+    void claimSlot(string doctorID, SlotTime dateTime);
+    void releaseSlot(string doctorID, SlotTime dateTime);
+    vector<SlotOffer> findEarliestSlots(string specialization, SlotTime afterDateTime, size_t count);
+
+    // Core operations shared by the interactive menus and the batch command engine
+    Appointment *bookAppointment(string patientID, string doctorID, string dateTime);
+    Appointment *bookAppointment(string patientID, string doctorID, SlotTime dateTime);
+    bool cancelAppointment(string patientID, string apptID, string reason);
+    bool rescheduleAppointment(string apptID, string newDateTime);
+    Appointment *requestEmergency(string patientID);
+    AppointmentStats computeStats();
+
+    // Waitlist backfill of freed slots
+    bool joinWaitlist(string patientID, string doctorID, string apptID);
+    void leaveWaitlist(string apptID);
+    int withdrawFromWaitlist(string patientID, string doctorID);
+    bool holdsUpcomingAppointment(string patientID, string doctorID, SlotTime after);
+    bool moveAppointment(Appointment &appt, SlotTime newDateTime);
+    int backfillSlot(string doctorID, SlotTime dateTime);
+
+    // Month-partitioned archive of closed appointment history
+    string archiveDir() const { return dataDir + "archive/"; }
+    void loadArchiveCatalog();
+    void saveArchiveCatalog();
+    int sealClosedPartitions();
+    bool scanSegment(const ArchiveSegment &segment, const function<bool(const Appointment &)> &visit);
+    bool scanArchivedMonth(const string &month, const function<bool(const Appointment &)> &visit);
+    void scanArchive(const function<bool(const Appointment &)> &visit);
+    const vector<Appointment> &loadArchivedMonth(const string &month);
+    bool findHistoricalAppointment(string apptID, string patientID, Appointment &found, int32_t monthHint = -1);
 };
 
 // Initialize static member
@@ -115,6 +909,7 @@ public:
         cout << "Enter new password: ";
         cin >> newPwd;
         password = hashPassword(newPwd);
+        HospitalSystem::instance->persistUser(*this);
         cout << "Password changed successfully!" << endl;
         HospitalSystem::instance->logAudit("Password changed", userID);
     }
@@ -124,13 +919,23 @@ class Doctor : public User
 {
 public:
     string specialization;
-    vector<string> availableSlots; // e.g., "2025-04-05 10:00"
+    vector<SlotTime> availableSlots; // Kept sorted
     bool onEmergencyDuty = false;
 
     Doctor() : User() {}
     Doctor(string id, string n, string pwd, string spec) : User(id, n, pwd, "doctor"), specialization(spec) {}
 
+    void addAvailableSlot(SlotTime slot)
+    {
+        auto pos = lower_bound(availableSlots.begin(), availableSlots.end(), slot);
+        if (pos == availableSlots.end() || *pos != slot)
+        {
+            availableSlots.insert(pos, slot);
+        }
+    }
+
     void viewAppointments();
+    int declareEmergency();
     void markEmergency();
     void updateAvailability();
     void viewPatientHistory(string patientID);
@@ -141,7 +946,7 @@ class Patient : public User
 {
 public:
     string medicalHistory;
-    vector<string> appointmentIDs;
+    vector<AppointmentRef> appointmentRefs;
 
     Patient() : User() {}
     Patient(string id, string n, string pwd, string history = "") : User(id, n, pwd, "patient"), medicalHistory(history) {}
@@ -150,6 +955,9 @@ public:
     void cancelAppointment();
     void viewMedicalRecords();
     void requestEmergency();
+    void findAvailableDoctor();
+    void joinWaitlist();
+    void leaveWaitlist();
     void displayMenu() override;
 };
 
@@ -166,22 +974,133 @@ public:
     void displayMenu() override;
 };
 
-// Implementation of Appointment methods
-void Appointment::reschedule()
+// Memory-mapped live state: the doctor, patient and appointment stores kept in one
+// file that is updated in place as records change. A restart maps the file and
+// validates its header instead of parsing the text files.
+//
+// Layout: MappedHeader, then fixed-width record sections for doctors, patients and
+// appointments, then a string arena. Records refer to strings by offset into the
+// arena, so the file can be mapped at any address. Changed strings are appended to
+// the arena; when a section or the arena fills up the image is rewritten from memory
+// with double the room, which also drops the garbage.
+
+// A string in the arena
+struct MappedStr
 {
-    string newDateTime;
-    cout << "Enter new date and time (YYYY-MM-DD HH:MM): ";
-    cin.ignore();
-    getline(cin, newDateTime);
+    uint32_t offset;
+    uint32_t length;
+};
 
-    // Check if the new slot is available
-    if (HospitalSystem::instance->isSlotAvailable(doctorID, newDateTime))
-    {
-        dateTime = newDateTime;
-        cout << "Appointment rescheduled to " << dateTime << endl;
-        HospitalSystem::instance->logAudit("Appointment rescheduled: " + apptID, patientID);
-    }
-    else
+struct MappedUser
+{
+    MappedStr id, name, password;
+    MappedStr detail; // Specialization for doctors, medical history for patients
+    MappedStr slots;  // Doctors: sorted availability as packed int32 SlotTimes
+};
+
+struct MappedAppointment
+{
+    MappedStr id, doctorID, patientID, status;
+    int32_t dateTime; // SlotTime minutes
+    uint32_t emergency;
+};
+
+// Version 1 images held times as text: comma-separated slots and this appointment record
+struct MappedAppointmentV1
+{
+    MappedStr id, doctorID, patientID, dateTime, status;
+    uint32_t emergency;
+};
+
+static_assert(sizeof(SlotTime) == sizeof(int32_t), "SlotTime is stored as a raw int32");
+
+// Offset of a section from the start of the file; capacity is in records, or bytes for the arena
+struct MappedSection
+{
+    uint64_t offset;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+struct MappedHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t userSize;
+    uint32_t appointmentSize;
+    uint64_t fileSize;
+    MappedSection doctors, patients, appointments, arena;
+    uint64_t checkpoints;
+    uint64_t layoutChecksum; // Everything above except the live counts and checkpoints
+    uint64_t textStamp;      // The record text files as this image last wrote or read them
+};
+
+static const char MAPPED_MAGIC[8] = {'H', 'S', 'M', 'A', 'P', '1', 0, 0};
+static const uint32_t MAPPED_VERSION = 3; // Versions 1 and 2 end at layoutChecksum
+
+class MappedStore
+{
+public:
+    explicit MappedStore(const string &path) : path(path) {}
+    ~MappedStore() { unmap(); }
+
+    bool load(HospitalSystem &hospital);
+    void create(HospitalSystem &hospital);
+    void checkpoint();
+    void textWritten();
+
+    void appendDoctor(const Doctor &doctor);
+    void appendPatient(const Patient &patient);
+    void appendAppointment(const Appointment &appt);
+    void updateDoctor(size_t index, const Doctor &doctor);
+    void updatePatient(size_t index, const Patient &patient);
+    void updateAppointment(size_t index, const Appointment &appt);
+
+    // Mutations between automatic checkpoints, and the longest gap in seconds
+    int checkpointEvery = 1000;
+    int checkpointSeconds = 5;
+
+private:
+    string path;
+    HospitalSystem *owner = nullptr; // Source of truth when the image has to be rewritten
+    int fd = -1;
+    char *base = nullptr;
+    size_t size = 0;
+    int pendingMutations = 0;
+    time_t lastCheckpoint = 0;
+
+    MappedHeader *header() { return (MappedHeader *)base; }
+    template <typename T>
+    T *record(const MappedSection &section, uint64_t index) { return (T *)(base + section.offset) + index; }
+
+    bool map(const string &file);
+    void unmap();
+    bool put(const string &value, MappedStr &ref);
+    bool get(MappedStr ref, string &value);
+    bool putUser(MappedUser &rec, const User &user, const string &detail, const string &slots);
+    bool putAppointment(MappedAppointment &rec, const Appointment &appt);
+    void mutated();
+    static uint64_t checksum(const MappedHeader &h);
+    static uint64_t textStamp(const string &dataDir);
+    static string packSlots(const Doctor &doctor);
+};
+
+
+// Implementation of Appointment methods
+void Appointment::reschedule()
+{
+    string newDateTime;
+    cout << "Enter new date and time (YYYY-MM-DD HH:MM): ";
+    cin.ignore();
+    getline(cin, newDateTime);
+
+    // Rescheduling may backfill the old slot and reallocate appointments, so don't touch members afterwards
+    if (HospitalSystem::instance->rescheduleAppointment(apptID, newDateTime))
+    {
+        cout << "Appointment rescheduled to " << parseDateTime(newDateTime) << endl;
+    }
+    else
     {
         cout << "Selected slot is not available. Please choose another time." << endl;
     }
@@ -189,7 +1108,12 @@ void Appointment::reschedule()
 
 void Appointment::cancel(string reason)
 {
+    if (occupiesSlot())
+    {
+        HospitalSystem::instance->releaseSlot(doctorID, dateTime);
+    }
     status = reason;
+    HospitalSystem::instance->persistAppointment(*this);
     HospitalSystem::instance->logAudit("Appointment cancelled: " + apptID + " Reason: " + reason, patientID);
 }
 
@@ -198,6 +1122,19 @@ void Doctor::viewAppointments()
 {
     cout << "Appointments for Dr. " << name << ":\n";
     bool found = false;
+
+    // Archived months first so the listing stays in chronological order; they are
+    // streamed from disk rather than loaded, so history is never held in memory
+    HospitalSystem::instance->scanArchive([&](const Appointment &appt)
+                                          {
+                                              if (appt.doctorID == userID)
+                                              {
+                                                  appt.display();
+                                                  found = true;
+                                              }
+                                              return true;
+                                          });
+
     for (const auto &appt : HospitalSystem::instance->appointments)
     {
         if (appt.doctorID == userID)
@@ -212,39 +1149,54 @@ void Doctor::viewAppointments()
     }
 }
 
-void Doctor::markEmergency()
+// Puts the doctor on emergency duty and returns how many appointments were cancelled
+int Doctor::declareEmergency()
 {
+    METRIC_TIMER("declare_emergency");
     onEmergencyDuty = true;
     // Cancel all non-emergency appointments for today
-    time_t now = time(0);
-    tm *ltm = localtime(&now);
-    char today[11];
-    strftime(today, sizeof(today), "%Y-%m-%d", ltm);
+    int32_t today = currentSlotTime().day();
 
     int cancelledCount = 0;
     for (auto &appt : HospitalSystem::instance->appointments)
     {
-        if (appt.doctorID == userID && appt.dateTime.substr(0, 10) == string(today) &&
+        if (appt.doctorID == userID && appt.dateTime.day() == today &&
             appt.status == "scheduled" && !appt.isEmergency)
         {
             appt.cancel("emergency-cancelled");
+            HospitalSystem::instance->leaveWaitlist(appt.apptID);
             cancelledCount++;
-            // In a real system, notify patient here
+            // The freed slot is not backfilled: the doctor is away on emergency duty
+            HospitalSystem::instance->notify(appt, "emergency-cancelled");
         }
     }
 
+    METRIC_COUNT("emergency_cancellations", cancelledCount);
+    HospitalSystem::instance->logAudit("Marked emergency duty", userID);
+    return cancelledCount;
+}
+
+void Doctor::markEmergency()
+{
+    int cancelledCount = declareEmergency();
     cout << "Doctor " << name << " is now on emergency duty. "
          << cancelledCount << " non-emergency appointments for today have been cancelled." << endl;
-    HospitalSystem::instance->logAudit("Marked emergency duty", userID);
 }
 
 void Doctor::updateAvailability()
 {
-    string slot;
+    string text;
     cout << "Enter new available slot (YYYY-MM-DD HH:MM): ";
     cin.ignore();
-    getline(cin, slot);
-    availableSlots.push_back(slot);
+    getline(cin, text);
+    SlotTime slot = parseDateTime(text);
+    if (!slot.isBookable())
+    {
+        cout << "Invalid slot. Slots start every " << SLOT_MINUTES << " minutes within working hours." << endl;
+        return;
+    }
+    addAvailableSlot(slot);
+    HospitalSystem::instance->persistUser(*this);
     cout << "Availability updated." << endl;
     HospitalSystem::instance->logAudit("Updated availability", userID);
 }
@@ -329,21 +1281,11 @@ void Patient::bookAppointment()
     cin.ignore();
     getline(cin, dateTime);
 
-    // Check doctor's availability
-    if (HospitalSystem::instance->isSlotAvailable(doctorID, dateTime))
+    // Book if the doctor's slot is free
+    Appointment *appt = HospitalSystem::instance->bookAppointment(userID, doctorID, dateTime);
+    if (appt)
     {
-        Appointment newAppt;
-        newAppt.apptID = to_string(rand() % 100000); // Simple random ID
-        newAppt.doctorID = doctorID;
-        newAppt.patientID = userID;
-        newAppt.dateTime = dateTime;
-        newAppt.status = "scheduled";
-
-        HospitalSystem::instance->appointments.push_back(newAppt);
-        appointmentIDs.push_back(newAppt.apptID);
-
-        cout << "Appointment booked successfully with ID: " << newAppt.apptID << endl;
-        HospitalSystem::instance->logAudit("Booked appointment: " + newAppt.apptID, userID);
+        cout << "Appointment booked successfully with ID: " << appt->apptID << endl;
     }
     else
     {
@@ -357,10 +1299,8 @@ void Patient::cancelAppointment()
     cout << "Enter Appointment ID to cancel: ";
     cin >> aptID;
 
-    Appointment *appt = HospitalSystem::instance->findAppointment(aptID);
-    if (appt && appt->patientID == userID && appt->status == "scheduled")
+    if (HospitalSystem::instance->cancelAppointment(userID, aptID, "patient-cancelled"))
     {
-        appt->cancel("patient-cancelled");
         cout << "Appointment cancelled successfully." << endl;
     }
     else
@@ -375,12 +1315,12 @@ void Patient::viewMedicalRecords()
     cout << "Appointments: " << endl;
 
     bool found = false;
-    for (const auto &apptID : appointmentIDs)
+    for (const auto &ref : appointmentRefs)
     {
-        Appointment *appt = HospitalSystem::instance->findAppointment(apptID);
-        if (appt)
+        Appointment appt;
+        if (HospitalSystem::instance->findHistoricalAppointment(ref.apptID, userID, appt, ref.month))
         {
-            appt->display();
+            appt.display();
             found = true;
         }
     }
@@ -398,43 +1338,88 @@ void Patient::requestEmergency()
     cout << "EMERGENCY REQUESTED!\n";
     cout << "Finding available doctors...\n";
 
-    // Find available doctors
-    vector<Doctor *> availableDoctors;
-    for (auto &doctor : HospitalSystem::instance->doctors)
+    Appointment *emergencyAppt = HospitalSystem::instance->requestEmergency(userID);
+    if (!emergencyAppt)
     {
-        if (doctor.onEmergencyDuty)
-        {
-            availableDoctors.push_back(&doctor);
-        }
+        cout << "No doctors available for emergency right now. Please try again later.\n";
+        return;
     }
 
-    if (availableDoctors.empty())
+    cout << "Emergency appointment created with Dr. " << HospitalSystem::instance->findDoctor(emergencyAppt->doctorID)->name
+         << ". Appointment ID: " << emergencyAppt->apptID << endl;
+}
+
+void Patient::findAvailableDoctor()
+{
+    string specialization, afterDateTime;
+    size_t count;
+    cout << "Enter Specialization: ";
+    cin.ignore();
+    getline(cin, specialization);
+    cout << "Earliest acceptable date and time (YYYY-MM-DD HH:MM): ";
+    getline(cin, afterDateTime);
+    cout << "Number of options to show: ";
+    cin >> count;
+
+    SlotTime after = parseDateTime(afterDateTime);
+    if (!after.valid())
     {
-        cout << "No doctors available for emergency right now. Please try again later.\n";
+        cout << "Invalid date and time." << endl;
         return;
     }
 
-    // Create emergency appointment with first available doctor
-    Appointment emergencyAppt;
-    emergencyAppt.apptID = "EMG-" + to_string(rand() % 10000);
-    emergencyAppt.doctorID = availableDoctors[0]->userID;
-    emergencyAppt.patientID = userID;
+    vector<SlotOffer> offers = HospitalSystem::instance->findEarliestSlots(specialization, after, count);
+    if (offers.empty())
+    {
+        cout << "No free slots found for " << specialization << "." << endl;
+        return;
+    }
 
-    // Set current time as appointment time
-    time_t now = time(0);
-    char dt[20];
-    strftime(dt, sizeof(dt), "%Y-%m-%d %H:%M", localtime(&now));
-    emergencyAppt.dateTime = dt;
-    emergencyAppt.status = "scheduled";
-    emergencyAppt.isEmergency = true;
+    for (const auto &offer : offers)
+    {
+        Doctor *doctor = HospitalSystem::instance->findDoctor(offer.doctorID);
+        cout << offer.dateTime << " - Dr. " << doctor->name << " (ID: " << offer.doctorID << ")" << endl;
+    }
+}
+
+void Patient::joinWaitlist()
+{
+    string doctorID, apptID;
+    cout << "Enter Doctor ID: ";
+    cin >> doctorID;
+    cout << "Enter your Appointment ID to move earlier (or 'none'): ";
+    cin >> apptID;
+    if (apptID == "none")
+    {
+        apptID.clear();
+    }
 
-    HospitalSystem::instance->appointments.push_back(emergencyAppt);
-    appointmentIDs.push_back(emergencyAppt.apptID);
+    if (HospitalSystem::instance->joinWaitlist(userID, doctorID, apptID))
+    {
+        cout << "You will be moved automatically if an earlier slot opens." << endl;
+    }
+    else
+    {
+        cout << "Could not join the waitlist. Check the doctor and appointment IDs; if you already have "
+                "an appointment with this doctor, enter its ID." << endl;
+    }
+}
 
-    cout << "Emergency appointment created with Dr. " << availableDoctors[0]->name
-         << ". Appointment ID: " << emergencyAppt.apptID << endl;
+void Patient::leaveWaitlist()
+{
+    string doctorID;
+    cout << "Enter Doctor ID: ";
+    cin >> doctorID;
 
-    HospitalSystem::instance->logAudit("Requested emergency appointment", userID);
+    int removed = HospitalSystem::instance->withdrawFromWaitlist(userID, doctorID);
+    if (removed)
+    {
+        cout << "Removed " << removed << " waitlist entr" << (removed == 1 ? "y" : "ies") << "." << endl;
+    }
+    else
+    {
+        cout << "You are not on this doctor's waitlist." << endl;
+    }
 }
 
 void Patient::displayMenu()
@@ -448,6 +1433,9 @@ void Patient::displayMenu()
         cout << "3. View Medical Records\n";
         cout << "4. Request Emergency\n";
         cout << "5. Change Password\n";
+        cout << "6. Find Next Available Doctor\n";
+        cout << "7. Join Waitlist for Earlier Slot\n";
+        cout << "8. Leave Waitlist\n";
         cout << "0. Logout\n";
         cout << "Enter your choice: ";
         cin >> choice;
@@ -469,6 +1457,15 @@ void Patient::displayMenu()
         case 5:
             changePassword();
             break;
+        case 6:
+            findAvailableDoctor();
+            break;
+        case 7:
+            joinWaitlist();
+            break;
+        case 8:
+            leaveWaitlist();
+            break;
         case 0:
             cout << "Logging out...\n";
             break;
@@ -492,7 +1489,11 @@ void Admin::addDoctor()
     cout << "Enter Password: ";
     cin >> password;
 
-    HospitalSystem::instance->doctors.push_back(Doctor(id, name, password, specialization));
+    if (!HospitalSystem::instance->registerDoctor(Doctor(id, name, password, specialization)))
+    {
+        cout << "A doctor with ID " << id << " already exists." << endl;
+        return;
+    }
     cout << "Doctor added successfully." << endl;
     HospitalSystem::instance->logAudit("Added doctor: " + id, userID);
 }
@@ -510,7 +1511,11 @@ void Admin::addPatient()
     cout << "Enter Password: ";
     cin >> password;
 
-    HospitalSystem::instance->patients.push_back(Patient(id, name, password, medicalHistory));
+    if (!HospitalSystem::instance->registerPatient(Patient(id, name, password, medicalHistory)))
+    {
+        cout << "A patient with ID " << id << " already exists." << endl;
+        return;
+    }
     cout << "Patient added successfully." << endl;
     HospitalSystem::instance->logAudit("Added patient: " + id, userID);
 }
@@ -520,27 +1525,21 @@ void Admin::generateReports()
     cout << "=== SYSTEM REPORT ===\n";
     cout << "Doctors: " << HospitalSystem::instance->doctors.size() << endl;
     cout << "Patients: " << HospitalSystem::instance->patients.size() << endl;
-    cout << "Appointments: " << HospitalSystem::instance->appointments.size() << endl;
-
-    int scheduled = 0, completed = 0, cancelled = 0, emergency = 0;
-    for (const auto &appt : HospitalSystem::instance->appointments)
+    AppointmentStats stats = HospitalSystem::instance->computeStats();
+    cout << "Appointments: " << stats.total << " (archived: "
+         << stats.total - HospitalSystem::instance->appointments.size() << ")" << endl;
+    cout << "  Scheduled: " << stats.scheduled << endl;
+    cout << "  Completed: " << stats.completed << endl;
+    cout << "  Cancelled: " << stats.cancelled << endl;
+    cout << "  Emergency: " << stats.emergency << endl;
+
+    NotificationService *notifier = HospitalSystem::instance->notifier;
+    if (notifier)
     {
-        if (appt.status == "scheduled")
-            scheduled++;
-        if (appt.status == "completed")
-            completed++;
-        if (appt.status == "cancelled" || appt.status == "patient-cancelled" ||
-            appt.status == "emergency-cancelled")
-            cancelled++;
-        if (appt.isEmergency)
-            emergency++;
+        cout << "Notifications: " << notifier->published << " sent, " << notifier->delivered << " delivered, "
+             << notifier->dropped << " dropped, " << notifier->depth() << " queued" << endl;
     }
 
-    cout << "  Scheduled: " << scheduled << endl;
-    cout << "  Completed: " << completed << endl;
-    cout << "  Cancelled: " << cancelled << endl;
-    cout << "  Emergency: " << emergency << endl;
-
     HospitalSystem::instance->logAudit("Generated report", userID);
 }
 
@@ -574,6 +1573,8 @@ void Admin::displayMenu()
         cout << "4. Manage Emergency Overrides\n";
         cout << "5. Backup Data\n";
         cout << "6. Change Password\n";
+        cout << "7. View Metrics\n";
+        cout << "8. Archive Closed History\n";
         cout << "0. Logout\n";
         cout << "Enter your choice: ";
         cin >> choice;
@@ -598,6 +1599,15 @@ void Admin::displayMenu()
         case 6:
             changePassword();
             break;
+        case 7:
+            if (HospitalSystem::instance->exportMetrics(&cout))
+                cout << "Snapshot written to metrics.prom" << endl;
+            else
+                cout << "Metrics are disabled in this build." << endl;
+            break;
+        case 8:
+            cout << HospitalSystem::instance->sealClosedPartitions() << " appointments archived." << endl;
+            break;
         case 0:
             cout << "Logging out...\n";
             break;
@@ -609,27 +1619,140 @@ void Admin::displayMenu()
 
 // Implementation of HospitalSystem methods
 void HospitalSystem::loadFromFile()
+{
+    METRIC_TIMER("load_from_file");
+
+    // A valid memory-mapped state file replaces parsing the text files
+    if (!mappedStore || !mappedStore->load(*this))
+    {
+        readRecordFiles();
+        if (mappedStore)
+        {
+            mappedStore->create(*this);
+        }
+    }
+
+    if (quarantined)
+    {
+        *statusOut << "Moved " << quarantined << " unreadable row(s) to " << dataDir << "quarantine.txt." << endl;
+        quarantined = 0;
+        quarantineRows.clear();
+        quarantineFile.close();
+    }
+
+    // Load admins (simple implementation)
+    admins.push_back(Admin("admin1", "System Administrator", "admin123"));
+
+    rebuildIndexes();
+
+    // Closed history moves to the archive so it is not carried in memory
+    loadArchiveCatalog();
+    sealClosedPartitions();
+
+    // Load waitlists; entries whose appointment is no longer open are dropped, as are
+    // any-time entries of patients who have booked the doctor since
+    waitlists.clear();
+    waitlistByAppt.clear();
+    ifstream waitFile(dataDir + "waitlist.txt");
+    if (waitFile.is_open())
+    {
+        string line;
+        while (getline(waitFile, line))
+        {
+            istringstream iss(line);
+            string doctorID, patientID, apptID;
+            if (getline(iss, doctorID, '|') && getline(iss, patientID, '|'))
+            {
+                getline(iss, apptID);
+                SlotTime key = WAITLIST_ANY_TIME;
+                if (!apptID.empty())
+                {
+                    Appointment *appt = findAppointment(apptID);
+                    if (!appt || appt->status != "scheduled" || waitlistByAppt.count(apptID))
+                        continue;
+                    key = appt->dateTime;
+                }
+                else if (holdsUpcomingAppointment(patientID, doctorID, currentSlotTime()))
+                {
+                    continue;
+                }
+                Waitlist::iterator entry = waitlists[doctorID].insert({key, {patientID, apptID}});
+                if (!apptID.empty())
+                    waitlistByAppt[apptID] = {doctorID, entry};
+            }
+        }
+        waitFile.close();
+    }
+
+    *statusOut << "Data loaded successfully." << endl;
+}
+
+// Keeps a row that cannot be loaded in quarantine.txt, tagged with the file it came from, so
+// the next save does not lose it; a row already there from an earlier load is not repeated
+void HospitalSystem::quarantine(const string &source, const string &row)
+{
+    string path = dataDir + "quarantine.txt";
+    if (quarantined++ == 0)
+    {
+        ifstream existing(path);
+        string line;
+        while (getline(existing, line))
+        {
+            quarantineRows.insert(line);
+        }
+        existing.close();
+        quarantineFile.open(path, ios::app);
+    }
+
+    string entry = source + "|" + row;
+    if (quarantineRows.insert(entry).second)
+    {
+        quarantineFile << entry << '\n';
+    }
+}
+
+// Parses doctors.txt, patients.txt and appointments.txt
+void HospitalSystem::readRecordFiles()
 {
     // Load doctors
-    ifstream docFile("doctors.txt");
+    ifstream docFile(dataDir + "doctors.txt");
     if (docFile.is_open())
     {
         string line;
         while (getline(docFile, line))
         {
             istringstream iss(line);
-            string id, name, spec, pwd;
+            string id, name, spec, pwd, slots;
             if (getline(iss, id, '|') && getline(iss, name, '|') &&
-                getline(iss, spec, '|') && getline(iss, pwd))
+                getline(iss, spec, '|') && getline(iss, pwd, '|'))
             {
-                doctors.push_back(Doctor(id, name, pwd, spec));
+                Doctor doctor(id, name, "", spec);
+                doctor.password = pwd; // Stored already hashed
+
+                // Optional trailing field: comma-separated available slots
+                getline(iss, slots);
+                istringstream slotStream(slots);
+                string slot;
+                while (getline(slotStream, slot, ','))
+                {
+                    SlotTime time = parseDateTime(slot);
+                    if (time.valid())
+                    {
+                        doctor.addAvailableSlot(time);
+                    }
+                    else if (!slot.empty())
+                    {
+                        quarantine("doctors.txt", id + "|" + slot);
+                    }
+                }
+                doctors.push_back(doctor);
             }
         }
         docFile.close();
     }
 
     // Load patients
-    ifstream patFile("patients.txt");
+    ifstream patFile(dataDir + "patients.txt");
     if (patFile.is_open())
     {
         string line;
@@ -640,125 +1763,239 @@ void HospitalSystem::loadFromFile()
             if (getline(iss, id, '|') && getline(iss, name, '|') &&
                 getline(iss, history, '|') && getline(iss, pwd))
             {
-                patients.push_back(Patient(id, name, pwd, history));
+                Patient patient(id, name, "", history);
+                patient.password = pwd; // Stored already hashed
+                patients.push_back(patient);
             }
         }
         patFile.close();
     }
 
-    // Load appointments
-    ifstream apptFile("appointments.txt");
+    // Load appointments; rows whose time cannot be parsed are quarantined
+    ifstream apptFile(dataDir + "appointments.txt");
     if (apptFile.is_open())
     {
-        string line;
+        string line, dateTime;
         while (getline(apptFile, line))
         {
             istringstream iss(line);
             Appointment appt;
             string emergencyFlag;
             if (getline(iss, appt.apptID, '|') && getline(iss, appt.doctorID, '|') &&
-                getline(iss, appt.patientID, '|') && getline(iss, appt.dateTime, '|') &&
+                getline(iss, appt.patientID, '|') && getline(iss, dateTime, '|') &&
                 getline(iss, appt.status, '|') && getline(iss, emergencyFlag))
             {
+                appt.dateTime = parseDateTime(dateTime);
+                if (!appt.dateTime.valid())
+                {
+                    quarantine("appointments.txt", line);
+                    continue;
+                }
                 appt.isEmergency = (emergencyFlag == "1");
                 appointments.push_back(appt);
             }
         }
         apptFile.close();
     }
+}
 
-    // Load admins (simple implementation)
-    admins.push_back(Admin("admin1", "System Administrator", "admin123"));
+void HospitalSystem::saveToFile()
+{
+    METRIC_TIMER("save_to_file");
+
+    // Only the hot window is rewritten; months that closed since loading are sealed first
+    sealClosedPartitions();
+
+    // The mapped state file is already current and only needs a durable checkpoint
+    if (mappedStore)
+    {
+        mappedStore->checkpoint();
+    }
+    else
+    {
+        writeRecordFiles();
+    }
+
+    // Save waitlists
+    ofstream waitFile(dataDir + "waitlist.txt");
+    for (const auto &waitlist : waitlists)
+    {
+        for (const auto &entry : waitlist.second)
+        {
+            waitFile << waitlist.first << "|" << entry.second.patientID << "|" << entry.second.apptID << endl;
+        }
+    }
+    waitFile.close();
 
-    cout << "Data loaded successfully." << endl;
+    *statusOut << "Data saved successfully." << endl;
 }
 
-void HospitalSystem::saveToFile()
+// Writes doctors.txt, patients.txt and appointments.txt
+void HospitalSystem::writeRecordFiles()
 {
     // Save doctors
-    ofstream docFile("doctors.txt");
+    ofstream docFile(dataDir + "doctors.txt");
     for (const auto &doc : doctors)
     {
-        docFile << doc.userID << "|" << doc.name << "|" << doc.specialization << "|" << doc.password << endl;
+        docFile << doc.userID << "|" << doc.name << "|" << doc.specialization << "|" << doc.password << "|";
+        for (size_t i = 0; i < doc.availableSlots.size(); i++)
+        {
+            docFile << (i ? "," : "") << doc.availableSlots[i];
+        }
+        docFile << endl;
     }
     docFile.close();
 
     // Save patients
-    ofstream patFile("patients.txt");
+    ofstream patFile(dataDir + "patients.txt");
     for (const auto &pat : patients)
     {
         patFile << pat.userID << "|" << pat.name << "|" << pat.medicalHistory << "|" << pat.password << endl;
     }
     patFile.close();
 
-    // Save appointments
-    ofstream apptFile("appointments.txt");
+    saveAppointments();
+}
+
+// Rewrites appointments.txt with the hot window
+void HospitalSystem::saveAppointments()
+{
+    string path = dataDir + "appointments.txt";
+    ofstream apptFile(path + ".tmp");
     for (const auto &appt : appointments)
     {
         apptFile << appt.apptID << "|" << appt.doctorID << "|" << appt.patientID << "|"
-                 << appt.dateTime << "|" << appt.status << "|" << (appt.isEmergency ? "1" : "0") << endl;
+                 << appt.dateTime << "|" << appt.status << "|" << (appt.isEmergency ? "1" : "0") << '\n';
     }
     apptFile.close();
-
-    cout << "Data saved successfully." << endl;
+    rename((path + ".tmp").c_str(), path.c_str());
 }
 
-void HospitalSystem::backupData()
+// Copies the data files into a timestamped directory and returns its path
+string HospitalSystem::backupData()
 {
+    METRIC_TIMER("backup_data");
     // Create backup with timestamp
-    time_t now = time(0);
+    tm now = localTime(time(0));
     char timestamp[20];
-    strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", localtime(&now));
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", &now);
 
-    string backupDir = "backup_" + string(timestamp) + "/";
+    string backupDir = dataDir + "backup_" + string(timestamp) + "/";
     system(("mkdir " + backupDir).c_str());
 
-    system(("copy doctors.txt " + backupDir + "doctors.txt").c_str());
-    system(("copy patients.txt " + backupDir + "patients.txt").c_str());
-    system(("copy appointments.txt " + backupDir + "appointments.txt").c_str());
-    system(("copy audit_log.txt " + backupDir + "audit_log.txt").c_str());
+    // In mapped mode the text files are not kept current, so export them first
+    if (mappedStore)
+    {
+        writeRecordFiles();
+        mappedStore->textWritten();
+    }
+
+    system(("copy " + dataDir + "doctors.txt " + backupDir + "doctors.txt").c_str());
+    system(("copy " + dataDir + "patients.txt " + backupDir + "patients.txt").c_str());
+    system(("copy " + dataDir + "appointments.txt " + backupDir + "appointments.txt").c_str());
+    system(("copy " + dataDir + "audit_log.txt " + backupDir + "audit_log.txt").c_str());
+    system(("copy " + dataDir + "quarantine.txt " + backupDir + "quarantine.txt").c_str());
 
-    cout << "Data backup completed to directory: " << backupDir << endl;
+    *statusOut << "Data backup completed to directory: " << backupDir << endl;
     logAudit("Data backup created", "system");
+    return backupDir;
 }
 
 void HospitalSystem::logAudit(string action, string userID)
 {
-    ofstream auditFile("audit_log.txt", ios::app);
-    time_t now = time(0);
+    METRIC_TIMER("log_audit");
+    if (!auditFile.is_open())
+    {
+        auditFile.open(dataDir + "audit_log.txt", ios::app);
+    }
+    tm now = localTime(time(0));
     char dt[30];
-    strftime(dt, sizeof(dt), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    auditFile << dt << " | User: " << userID << " | Action: " << action << endl;
-    auditFile.close();
+    strftime(dt, sizeof(dt), "%Y-%m-%d %H:%M:%S", &now);
+    auditFile << dt << " | User: " << userID << " | Action: " << action << '\n';
+    if (auditAutoFlush)
+    {
+        auditFile.flush();
+    }
 }
 
-Appointment *HospitalSystem::findAppointment(string apptID)
+void HospitalSystem::notify(const Appointment &appt, string event)
 {
-    for (auto &appt : appointments)
+    if (notifier)
     {
-        if (appt.apptID == apptID)
-        {
-            return &appt;
-        }
+        notifier->publish({appt.patientID, event, appt.apptID, appt.dateTime, {}});
     }
-    return nullptr;
 }
 
-bool HospitalSystem::isSlotAvailable(string doctorID, string dateTime)
+// Write-through of a changed record to the mapped state file, if one is in use
+void HospitalSystem::persistAppointment(const Appointment &appt)
 {
-    for (const auto &appt : appointments)
+    if (!mappedStore)
+        return;
+    auto it = appointmentIndex.find(appt.apptID);
+    if (it != appointmentIndex.end())
+        mappedStore->updateAppointment(it->second, appt);
+}
+
+void HospitalSystem::persistUser(const User &user)
+{
+    if (!mappedStore)
+        return;
+    if (user.role == "doctor" && doctorIndex.count(user.userID))
     {
-        if (appt.doctorID == doctorID && appt.dateTime == dateTime &&
-            (appt.status == "scheduled" || appt.status == "completed"))
-        {
-            return false;
-        }
+        size_t index = doctorIndex[user.userID];
+        mappedStore->updateDoctor(index, doctors[index]);
+    }
+    else if (user.role == "patient" && patientIndex.count(user.userID))
+    {
+        size_t index = patientIndex[user.userID];
+        mappedStore->updatePatient(index, patients[index]);
+    }
+}
+
+// Writes a Prometheus text snapshot to metrics.prom and, if given, to dump
+bool HospitalSystem::exportMetrics(ostream *dump)
+{
+#if HS_METRICS
+    ofstream metricsFile(dataDir + "metrics.prom");
+    Metrics::writePrometheus(metricsFile);
+    if (dump)
+    {
+        Metrics::writePrometheus(*dump);
     }
     return true;
+#else
+    (void)dump;
+    return false;
+#endif
+}
+
+Appointment *HospitalSystem::findAppointment(string apptID)
+{
+    METRIC_TIMER("find_appointment");
+    auto it = appointmentIndex.find(apptID);
+    return it == appointmentIndex.end() ? nullptr : &appointments[it->second];
+}
+
+bool HospitalSystem::isSlotAvailable(string doctorID, SlotTime dateTime)
+{
+    METRIC_TIMER("is_slot_available");
+    // Sealed months are closed history and cannot take new bookings
+    if (!dateTime.valid() || dateTime.month() <= sealedThrough)
+    {
+        return false;
+    }
+    auto booked = bookedSlots.find(doctorID);
+    return booked == bookedSlots.end() || booked->second.find(dateTime.slot()) == booked->second.end();
+}
+
+bool HospitalSystem::isSlotAvailable(string doctorID, string dateTime)
+{
+    return isSlotAvailable(doctorID, parseDateTime(dateTime));
 }
 
 User *HospitalSystem::authenticateUser(string userID, string password)
 {
+    METRIC_TIMER("authenticate_user");
     // Check doctors
     for (auto &doctor : doctors)
     {
@@ -786,40 +2023,1837 @@ User *HospitalSystem::authenticateUser(string userID, string password)
         }
     }
 
+    METRIC_COUNT("login_failures", 1);
     return nullptr;
 }
 
 Doctor *HospitalSystem::findDoctor(string doctorID)
 {
-    for (auto &doctor : doctors)
+    METRIC_TIMER("find_doctor");
+    auto it = doctorIndex.find(doctorID);
+    return it == doctorIndex.end() ? nullptr : &doctors[it->second];
+}
+
+Patient *HospitalSystem::findPatient(string patientID)
+{
+    METRIC_TIMER("find_patient");
+    auto it = patientIndex.find(patientID);
+    return it == patientIndex.end() ? nullptr : &patients[it->second];
+}
+
+void HospitalSystem::rebuildIndexes()
+{
+    METRIC_TIMER("rebuild_indexes");
+    doctorIndex.clear();
+    patientIndex.clear();
+    appointmentIndex.clear();
+    patientAppointments.clear();
+    specializationIndex.clear();
+    bookedSlots.clear();
+
+    // A duplicated ID in the data files resolves to its first record everywhere
+    for (size_t i = 0; i < doctors.size(); i++)
     {
-        if (doctor.userID == doctorID)
+        if (doctorIndex.emplace(doctors[i].userID, i).second)
         {
-            return &doctor;
+            specializationIndex[doctors[i].specialization].push_back(i);
         }
     }
-    return nullptr;
-}
 
-Patient *HospitalSystem::findPatient(string patientID)
-{
-    for (auto &patient : patients)
+    for (size_t i = 0; i < patients.size(); i++)
+    {
+        patientIndex.emplace(patients[i].userID, i);
+    }
+
+    for (size_t i = 0; i < appointments.size(); i++)
     {
-        if (patient.userID == patientID)
+        appointmentIndex[appointments[i].apptID] = i;
+        patientAppointments[appointments[i].patientID].push_back(i);
+        if (appointments[i].occupiesSlot())
         {
-            return &patient;
+            claimSlot(appointments[i].doctorID, appointments[i].dateTime);
         }
     }
-    return nullptr;
 }
 
-// Main function
-int main()
+// Returns false, changing nothing, if the ID is already taken
+bool HospitalSystem::registerDoctor(const Doctor &doctor)
 {
-    srand(time(0)); // Seed for random numbers
+    if (doctorIndex.count(doctor.userID))
+    {
+        return false;
+    }
+    doctors.push_back(doctor);
+    doctorIndex[doctor.userID] = doctors.size() - 1;
+    specializationIndex[doctor.specialization].push_back(doctors.size() - 1);
+    if (mappedStore)
+    {
+        mappedStore->appendDoctor(doctor);
+    }
+    return true;
+}
 
-    HospitalSystem hospital;
-    hospital.loadFromFile();
+bool HospitalSystem::registerPatient(const Patient &patient)
+{
+    if (patientIndex.count(patient.userID))
+    {
+        return false;
+    }
+    patients.push_back(patient);
+    patientIndex[patient.userID] = patients.size() - 1;
+    if (mappedStore)
+    {
+        mappedStore->appendPatient(patient);
+    }
+    return true;
+}
+
+void HospitalSystem::addAppointment(const Appointment &appt)
+{
+    appointments.push_back(appt);
+    appointmentIndex[appt.apptID] = appointments.size() - 1;
+    patientAppointments[appt.patientID].push_back(appointments.size() - 1);
+    if (mappedStore)
+    {
+        mappedStore->appendAppointment(appt);
+    }
+    if (appt.occupiesSlot())
+    {
+        claimSlot(appt.doctorID, appt.dateTime);
+    }
+}
+
+// Numeric part of a generated appointment ID ("123" or "EMG-123") plus one, or 0 if it has none
+static uint64_t appointmentNumberCeiling(const string &apptID)
+{
+    size_t start = apptID.rfind("EMG-", 0) == 0 ? 4 : 0;
+    if (start == apptID.size() || apptID.size() - start > 18 ||
+        !all_of(apptID.begin() + start, apptID.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        return 0;
+    return stoull(apptID.substr(start)) + 1;
+}
+
+// Random appointment ID not already in use; the range grows with the number of appointments.
+// Numbers start above every archived one, so a sealed appointment's ID is never reissued.
+string HospitalSystem::generateAppointmentID(string prefix)
+{
+    size_t range = max<size_t>(100000, appointments.size() * 10);
+    string id;
+    do
+    {
+        id = prefix + to_string(archivedIDCeiling + ((size_t)rand() * ((size_t)RAND_MAX + 1) + rand()) % range);
+    } while (appointmentIndex.count(id));
+    return id;
+}
+
+// Appointments hold the whole slot their time falls in, so an emergency at 10:17 blocks the 10:00 slot
+void HospitalSystem::claimSlot(string doctorID, SlotTime dateTime)
+{
+    bookedSlots[doctorID].insert(dateTime.slot());
+}
+
+void HospitalSystem::releaseSlot(string doctorID, SlotTime dateTime)
+{
+    auto booked = bookedSlots.find(doctorID);
+    if (booked == bookedSlots.end())
+    {
+        return;
+    }
+    auto slot = booked->second.find(dateTime.slot());
+    if (slot != booked->second.end())
+    {
+        booked->second.erase(slot);
+    }
+}
+
+// Earliest free slots at or after afterDateTime across all doctors of a specialization.
+// Each doctor contributes one cursor into its sorted availableSlots; a min-heap merges
+// the cursors so only slots up to the last returned offer are ever examined.
+vector<SlotOffer> HospitalSystem::findEarliestSlots(string specialization, SlotTime afterDateTime, size_t count)
+{
+    METRIC_TIMER("find_earliest_slots");
+    vector<SlotOffer> offers;
+    auto spec = specializationIndex.find(specialization);
+    if (spec == specializationIndex.end() || count == 0)
+    {
+        return offers;
+    }
+
+    struct Cursor
+    {
+        const SlotTime *slot;
+        size_t doctorPos;
+        size_t slotPos;
+    };
+    auto later = [](const Cursor &a, const Cursor &b)
+    {
+        return *a.slot != *b.slot ? *a.slot > *b.slot : a.doctorPos > b.doctorPos;
+    };
+    priority_queue<Cursor, vector<Cursor>, decltype(later)> heap(later);
+
+    for (size_t pos : spec->second)
+    {
+        const vector<SlotTime> &slots = doctors[pos].availableSlots;
+        auto first = lower_bound(slots.begin(), slots.end(), afterDateTime);
+        if (first != slots.end())
+        {
+            heap.push({&*first, pos, size_t(first - slots.begin())});
+        }
+    }
+
+    while (!heap.empty() && offers.size() < count)
+    {
+        Cursor cur = heap.top();
+        heap.pop();
+
+        const Doctor &doctor = doctors[cur.doctorPos];
+        if (isSlotAvailable(doctor.userID, *cur.slot))
+        {
+            offers.push_back({doctor.userID, *cur.slot});
+        }
+
+        if (cur.slotPos + 1 < doctor.availableSlots.size())
+        {
+            heap.push({&doctor.availableSlots[cur.slotPos + 1], cur.doctorPos, cur.slotPos + 1});
+        }
+    }
+
+    return offers;
+}
+
+Appointment *HospitalSystem::bookAppointment(string patientID, string doctorID, string dateTime)
+{
+    return bookAppointment(patientID, doctorID, parseDateTime(dateTime));
+}
+
+Appointment *HospitalSystem::bookAppointment(string patientID, string doctorID, SlotTime dateTime)
+{
+    METRIC_TIMER("book_appointment");
+    Patient *patient = findPatient(patientID);
+    if (!patient || !findDoctor(doctorID) || !dateTime.isBookable() || !isSlotAvailable(doctorID, dateTime))
+    {
+        METRIC_COUNT("bookings_rejected", 1);
+        return nullptr;
+    }
+    METRIC_COUNT("bookings", 1);
+
+    Appointment newAppt;
+    newAppt.apptID = generateAppointmentID("");
+    newAppt.doctorID = doctorID;
+    newAppt.patientID = patientID;
+    newAppt.dateTime = dateTime;
+    newAppt.status = "scheduled";
+
+    addAppointment(newAppt);
+    patient->appointmentRefs.push_back({newAppt.apptID, newAppt.dateTime.month()});
+
+    // A patient waiting for any slot with this doctor has one now
+    auto waitlist = waitlists.find(doctorID);
+    if (waitlist != waitlists.end())
+    {
+        auto open = waitlist->second.equal_range(WAITLIST_ANY_TIME);
+        for (auto it = open.first; it != open.second;)
+        {
+            it = it->second.patientID == patientID ? waitlist->second.erase(it) : next(it);
+        }
+    }
+
+    logAudit("Booked appointment: " + newAppt.apptID, patientID);
+    notify(newAppt, "booked");
+    return &appointments.back();
+}
+
+bool HospitalSystem::cancelAppointment(string patientID, string apptID, string reason)
+{
+    METRIC_TIMER("cancel_appointment");
+    Appointment *appt = findAppointment(apptID);
+    if (!appt || appt->patientID != patientID || appt->status != "scheduled")
+    {
+        METRIC_COUNT("cancellations_rejected", 1);
+        return false;
+    }
+    METRIC_COUNT("cancellations", 1);
+    string doctorID = appt->doctorID;
+    SlotTime dateTime = appt->dateTime;
+    appt->cancel(reason);
+    notify(*appt, reason);
+    leaveWaitlist(apptID);
+    backfillSlot(doctorID, dateTime);
+    return true;
+}
+
+bool HospitalSystem::rescheduleAppointment(string apptID, string newDateTime)
+{
+    METRIC_TIMER("reschedule_appointment");
+    Appointment *appt = findAppointment(apptID);
+    SlotTime slot = parseDateTime(newDateTime);
+    if (!appt || !slot.isBookable())
+    {
+        METRIC_COUNT("reschedules_rejected", 1);
+        return false;
+    }
+    string doctorID = appt->doctorID;
+    SlotTime oldDateTime = appt->dateTime;
+    if (!moveAppointment(*appt, slot))
+    {
+        METRIC_COUNT("reschedules_rejected", 1);
+        return false;
+    }
+    METRIC_COUNT("reschedules", 1);
+    logAudit("Appointment rescheduled: " + apptID, appt->patientID);
+    notify(*appt, "rescheduled");
+
+    backfillSlot(doctorID, oldDateTime);
+    return true;
+}
+
+// Creates an appointment for now with the first doctor on emergency duty
+Appointment *HospitalSystem::requestEmergency(string patientID)
+{
+    METRIC_TIMER("request_emergency");
+    Patient *patient = findPatient(patientID);
+    Doctor *doctor = nullptr;
+    for (auto &candidate : doctors)
+    {
+        if (candidate.onEmergencyDuty)
+        {
+            doctor = &candidate;
+            break;
+        }
+    }
+    if (!patient || !doctor)
+    {
+        return nullptr;
+    }
+
+    Appointment emergencyAppt;
+    emergencyAppt.apptID = generateAppointmentID("EMG-");
+    emergencyAppt.doctorID = doctor->userID;
+    emergencyAppt.patientID = patientID;
+
+    // Set current time as appointment time
+    emergencyAppt.dateTime = currentSlotTime();
+    emergencyAppt.status = "scheduled";
+    emergencyAppt.isEmergency = true;
+
+    addAppointment(emergencyAppt);
+    patient->appointmentRefs.push_back({emergencyAppt.apptID, emergencyAppt.dateTime.month()});
+
+    logAudit("Requested emergency appointment", patientID);
+    notify(emergencyAppt, "emergency-booked");
+    return &appointments.back();
+}
+
+// Adds a patient to a doctor's waitlist. With an apptID the patient's existing
+// appointment is moved when an earlier slot opens; without one a new appointment
+// is booked in the first slot that opens.
+bool HospitalSystem::joinWaitlist(string patientID, string doctorID, string apptID)
+{
+    if (!findPatient(patientID) || !findDoctor(doctorID))
+    {
+        return false;
+    }
+
+    SlotTime key = WAITLIST_ANY_TIME;
+    if (!apptID.empty())
+    {
+        Appointment *appt = findAppointment(apptID);
+        if (!appt || appt->patientID != patientID || appt->doctorID != doctorID ||
+            appt->status != "scheduled" || waitlistByAppt.count(apptID))
+        {
+            return false;
+        }
+        key = appt->dateTime;
+    }
+    else
+    {
+        // A patient with an upcoming booking waits with its apptID instead; booking
+        // purges any-time entries, so none can go stale
+        if (holdsUpcomingAppointment(patientID, doctorID, currentSlotTime()))
+        {
+            return false;
+        }
+        auto open = waitlists[doctorID].equal_range(WAITLIST_ANY_TIME);
+        for (auto it = open.first; it != open.second; ++it)
+        {
+            if (it->second.patientID == patientID)
+                return false;
+        }
+    }
+
+    Waitlist::iterator entry = waitlists[doctorID].insert({key, {patientID, apptID}});
+    if (!apptID.empty())
+    {
+        waitlistByAppt[apptID] = {doctorID, entry};
+    }
+    logAudit("Joined waitlist for Dr. " + doctorID, patientID);
+    return true;
+}
+
+void HospitalSystem::leaveWaitlist(string apptID)
+{
+    auto waiting = waitlistByAppt.find(apptID);
+    if (waiting != waitlistByAppt.end())
+    {
+        waitlists[waiting->second.first].erase(waiting->second.second);
+        waitlistByAppt.erase(waiting);
+    }
+}
+
+// Removes every waitlist entry a patient holds with a doctor; returns how many
+int HospitalSystem::withdrawFromWaitlist(string patientID, string doctorID)
+{
+    auto waitlist = waitlists.find(doctorID);
+    if (waitlist == waitlists.end())
+    {
+        return 0;
+    }
+
+    int removed = 0;
+    for (auto it = waitlist->second.begin(); it != waitlist->second.end();)
+    {
+        if (it->second.patientID != patientID)
+        {
+            ++it;
+            continue;
+        }
+        waitlistByAppt.erase(it->second.apptID);
+        it = waitlist->second.erase(it);
+        removed++;
+    }
+    if (removed)
+    {
+        logAudit("Left waitlist for Dr. " + doctorID, patientID);
+    }
+    return removed;
+}
+
+// Looks only at the patient's own appointments
+bool HospitalSystem::holdsUpcomingAppointment(string patientID, string doctorID, SlotTime after)
+{
+    auto held = patientAppointments.find(patientID);
+    if (held == patientAppointments.end())
+    {
+        return false;
+    }
+    return any_of(held->second.begin(), held->second.end(), [&](size_t pos)
+                  { const Appointment &appt = appointments[pos];
+                    return appt.doctorID == doctorID && appt.status == "scheduled" && appt.dateTime > after; });
+}
+
+// Moves an appointment to a free slot of the same doctor. The new slot is claimed
+// before the old one is released, so the appointment never holds zero or two slots.
+bool HospitalSystem::moveAppointment(Appointment &appt, SlotTime newDateTime)
+{
+    if (!isSlotAvailable(appt.doctorID, newDateTime))
+    {
+        return false;
+    }
+
+    if (appt.occupiesSlot())
+    {
+        claimSlot(appt.doctorID, newDateTime);
+        releaseSlot(appt.doctorID, appt.dateTime);
+    }
+    appt.dateTime = newDateTime;
+    persistAppointment(appt);
+
+    // Keep the waitlist key in step with the time the patient now holds
+    auto waiting = waitlistByAppt.find(appt.apptID);
+    if (waiting != waitlistByAppt.end())
+    {
+        Waitlist &waitlist = waitlists[waiting->second.first];
+        WaitlistEntry entry = waiting->second.second->second;
+        waitlist.erase(waiting->second.second);
+        waiting->second.second = waitlist.insert({newDateTime, entry});
+    }
+    return true;
+}
+
+// Offers a freed future slot to the doctor's waitlist. When the taker already had an
+// appointment, that later slot is freed in turn and offered again, so one cancellation
+// can pull several patients forward. Each step is O(log n). Returns the number of moves.
+int HospitalSystem::backfillSlot(string doctorID, SlotTime dateTime)
+{
+    METRIC_TIMER("backfill_slot");
+    Doctor *doctor = findDoctor(doctorID);
+    if (!doctor || doctor->onEmergencyDuty)
+    {
+        return 0;
+    }
+
+    // Offer the whole freed slot; an emergency at an odd time frees the slot it fell in
+    int filled = 0;
+    SlotTime now = currentSlotTime();
+    dateTime = {dateTime.slot() * SLOT_MINUTES};
+    while (dateTime > now && dateTime.isBookable() && isSlotAvailable(doctorID, dateTime))
+    {
+        auto waitlist = waitlists.find(doctorID);
+        if (waitlist == waitlists.end() || waitlist->second.empty())
+        {
+            break;
+        }
+        auto best = prev(waitlist->second.end());
+        if (best->first <= dateTime)
+        {
+            break; // Nobody waiting would move earlier
+        }
+
+        WaitlistEntry entry = best->second;
+        waitlist->second.erase(best);
+        if (entry.apptID.empty())
+        {
+            if (bookAppointment(entry.patientID, doctorID, dateTime))
+            {
+                filled++;
+                logAudit("Booked from waitlist: " + formatDateTime(dateTime) + " with Dr. " + doctorID, entry.patientID);
+            }
+            continue;
+        }
+
+        waitlistByAppt.erase(entry.apptID);
+        Appointment *appt = findAppointment(entry.apptID);
+        if (!appt || appt->status != "scheduled" || appt->doctorID != doctorID)
+        {
+            continue; // Stale entry, e.g. the appointment was archived
+        }
+        SlotTime vacated = appt->dateTime;
+        if (moveAppointment(*appt, dateTime))
+        {
+            filled++;
+            logAudit("Moved earlier from waitlist: " + entry.apptID + " to " + formatDateTime(dateTime), entry.patientID);
+            notify(*appt, "moved-earlier");
+            dateTime = vacated;
+        }
+    }
+
+    METRIC_COUNT("waitlist_backfills", filled);
+    return filled;
+}
+
+AppointmentStats HospitalSystem::computeStats()
+{
+    METRIC_TIMER("compute_stats");
+    AppointmentStats stats;
+    for (const auto &appt : appointments)
+    {
+        stats.count(appt);
+    }
+
+    // Archived months are summarised in the catalog, so they need not be loaded
+    for (const auto &segment : archiveCatalog)
+    {
+        stats.total += segment.stats.total;
+        stats.scheduled += segment.stats.scheduled;
+        stats.completed += segment.stats.completed;
+        stats.cancelled += segment.stats.cancelled;
+        stats.emergency += segment.stats.emergency;
+    }
+    return stats;
+}
+
+// Archive segment layout: "HSARC3\n", uint32 record count, then per record
+// a status code byte, an emergency byte, apptID, doctorID and patientID each prefixed
+// with a uint32 length, and the int32 SlotTime. Status code 255 is followed by the
+// status string. Older segments prefix strings with a single length byte: "HSARC2\n"
+// otherwise matches, and "HSARC1\n" also holds the time as a string.
+static const char ARCHIVE_MAGIC[] = "HSARC3\n";
+static const char ARCHIVE_MAGIC_V2[] = "HSARC2\n";
+static const char ARCHIVE_MAGIC_V1[] = "HSARC1\n";
+static const char *ARCHIVE_STATUSES[] = {"scheduled", "completed", "cancelled", "patient-cancelled", "emergency-cancelled"};
+
+static void writeArchiveString(ostream &out, const string &value)
+{
+    uint32_t len = (uint32_t)value.size(); // Fields come from text lines, far below 4 GiB
+    out.write((const char *)&len, sizeof(len));
+    out.write(value.data(), len);
+}
+
+// byteLengths reads the single-byte prefixes of HSARC1 and HSARC2 segments
+static bool readArchiveString(istream &in, string &value, bool byteLengths)
+{
+    uint32_t len = 0;
+    if (byteLengths)
+    {
+        int byte = in.get();
+        if (byte == EOF)
+            return false;
+        len = (uint32_t)byte;
+    }
+    else if (!in.read((char *)&len, sizeof(len)) || len > (1u << 24))
+    {
+        return false; // A corrupt prefix must not become a huge allocation
+    }
+    value.resize(len);
+    return (bool)in.read(&value[0], len);
+}
+
+void HospitalSystem::loadArchiveCatalog()
+{
+    archiveCatalog.clear();
+    loadedArchives.clear();
+    archiveCacheOrder.clear();
+    sealedThrough = -1;
+    archivedIDCeiling = 0;
+
+    ifstream catalogFile(archiveDir() + "catalog.txt");
+    string line;
+    bool upgraded = false;
+    while (getline(catalogFile, line))
+    {
+        istringstream iss(line);
+        ArchiveSegment segment;
+        char sep;
+        if (getline(iss, segment.month, '|') && getline(iss, segment.file, '|') &&
+            iss >> segment.stats.total >> sep >> segment.stats.scheduled >> sep >> segment.stats.completed >> sep >>
+                segment.stats.cancelled >> sep >> segment.stats.emergency)
+        {
+            // Catalogs written before the ceiling was recorded get it from one pass over the segment
+            if (!(iss >> sep >> segment.idCeiling))
+            {
+                scanSegment(segment, [&](const Appointment &appt)
+                            {
+                                segment.idCeiling = max(segment.idCeiling, appointmentNumberCeiling(appt.apptID));
+                                return true;
+                            });
+                upgraded = true;
+            }
+            archiveCatalog.push_back(segment);
+            archivedIDCeiling = max(archivedIDCeiling, segment.idCeiling);
+            SlotTime monthStart = parseDateTime(segment.month + "-01 00:00");
+            if (monthStart.valid())
+                sealedThrough = max(sealedThrough, monthStart.month());
+        }
+    }
+    catalogFile.close();
+    if (upgraded)
+    {
+        saveArchiveCatalog();
+    }
+}
+
+void HospitalSystem::saveArchiveCatalog()
+{
+    // Replace the catalog atomically so a crash never leaves it half written
+    string path = archiveDir() + "catalog.txt";
+    {
+        ofstream catalogFile(path + ".tmp");
+        for (const auto &segment : archiveCatalog)
+        {
+            catalogFile << segment.month << "|" << segment.file << "|" << segment.stats.total << "|"
+                        << segment.stats.scheduled << "|" << segment.stats.completed << "|"
+                        << segment.stats.cancelled << "|" << segment.stats.emergency << "|" << segment.idCeiling << endl;
+        }
+    }
+    rename((path + ".tmp").c_str(), path.c_str());
+}
+
+// Moves every appointment in months that ended more than archiveGraceMonths ago out of
+// the hot window into new archive segments. Returns the number of appointments sealed.
+int HospitalSystem::sealClosedPartitions()
+{
+    METRIC_TIMER("seal_closed_partitions");
+
+    int32_t cutoff = currentSlotTime().month() - archiveGraceMonths;
+    auto isClosed = [&](const Appointment &appt)
+    { return appt.dateTime.month() < cutoff; };
+    if (none_of(appointments.begin(), appointments.end(), isClosed))
+    {
+        return 0;
+    }
+
+    map<int32_t, vector<Appointment>> closed;
+    vector<Appointment> hot;
+    for (auto &appt : appointments)
+    {
+        if (isClosed(appt))
+            closed[appt.dateTime.month()].push_back(move(appt));
+        else
+            hot.push_back(move(appt));
+    }
+    filesystem::create_directories(archiveDir());
+    int sealed = 0;
+    for (auto &entry : closed)
+    {
+        string month = formatMonth(entry.first);
+        int segmentNo = 0;
+        for (const auto &segment : archiveCatalog)
+        {
+            if (segment.month == month)
+                segmentNo++;
+        }
+        sealedThrough = max(sealedThrough, entry.first);
+
+        // Rows already in the month's segments were sealed before a crash kept the
+        // hot file from being rewritten; they are dropped rather than archived twice
+        if (segmentNo > 0)
+        {
+            set<string> archived;
+            scanArchivedMonth(month, [&](const Appointment &appt)
+                              { archived.insert(appt.apptID); return true; });
+            entry.second.erase(remove_if(entry.second.begin(), entry.second.end(),
+                                         [&](const Appointment &appt)
+                                         { return archived.count(appt.apptID) > 0; }),
+                               entry.second.end());
+            if (entry.second.empty())
+                continue;
+        }
+
+        ArchiveSegment segment;
+        segment.month = month;
+        segment.file = "appointments_" + month + "_" + to_string(segmentNo) + ".arc";
+
+        string path = archiveDir() + segment.file;
+        {
+            ofstream out(path + ".tmp", ios::binary);
+            out.write(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC) - 1);
+            uint32_t count = (uint32_t)entry.second.size();
+            out.write((const char *)&count, sizeof(count));
+            for (const auto &appt : entry.second)
+            {
+                uint8_t code = 255;
+                for (uint8_t i = 0; i < sizeof(ARCHIVE_STATUSES) / sizeof(ARCHIVE_STATUSES[0]); i++)
+                {
+                    if (appt.status == ARCHIVE_STATUSES[i])
+                        code = i;
+                }
+                out.put((char)code);
+                out.put(appt.isEmergency ? 1 : 0);
+                writeArchiveString(out, appt.apptID);
+                writeArchiveString(out, appt.doctorID);
+                writeArchiveString(out, appt.patientID);
+                out.write((const char *)&appt.dateTime.minutes, sizeof(appt.dateTime.minutes));
+                if (code == 255)
+                    writeArchiveString(out, appt.status);
+                segment.stats.count(appt);
+                segment.idCeiling = max(segment.idCeiling, appointmentNumberCeiling(appt.apptID));
+            }
+        }
+        rename((path + ".tmp").c_str(), path.c_str());
+
+        archiveCatalog.push_back(segment);
+        archivedIDCeiling = max(archivedIDCeiling, segment.idCeiling);
+        sealed += (int)entry.second.size();
+
+        // A cached copy of the month is now incomplete
+        loadedArchives.erase(month);
+        archiveCacheOrder.erase(remove(archiveCacheOrder.begin(), archiveCacheOrder.end(), month),
+                                archiveCacheOrder.end());
+    }
+    saveArchiveCatalog();
+
+    // Drop the sealed rows from disk too, or the next load would archive them again. In
+    // mapped mode the text files are brought up to date before the image records them.
+    appointments = move(hot);
+    rebuildIndexes();
+    if (mappedStore)
+    {
+        writeRecordFiles();
+        mappedStore->create(*this);
+    }
+    else
+    {
+        saveAppointments();
+    }
+    logAudit("Archived " + to_string(sealed) + " appointments through " + formatMonth(sealedThrough), "system");
+    return sealed;
+}
+
+// Streams the rows of one segment without caching them. visit returns false to stop
+// early; the result is false if it did.
+bool HospitalSystem::scanSegment(const ArchiveSegment &segment, const function<bool(const Appointment &)> &visit)
+{
+    ifstream in(archiveDir() + segment.file, ios::binary);
+    char magic[sizeof(ARCHIVE_MAGIC) - 1];
+    uint32_t count = 0;
+    in.read(magic, sizeof(magic));
+    string version(magic, sizeof(magic));
+    bool textTimes = version == ARCHIVE_MAGIC_V1;
+    bool byteLengths = textTimes || version == ARCHIVE_MAGIC_V2;
+    if (!in || (!byteLengths && version != ARCHIVE_MAGIC) || !in.read((char *)&count, sizeof(count)))
+    {
+        *statusOut << "Archive segment " << segment.file << " is missing or corrupt." << endl;
+        return true;
+    }
+
+    string dateTime;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Appointment appt;
+        int code = in.get();
+        int emergency = in.get();
+        if (code == EOF || emergency == EOF || !readArchiveString(in, appt.apptID, byteLengths) ||
+            !readArchiveString(in, appt.doctorID, byteLengths) || !readArchiveString(in, appt.patientID, byteLengths) ||
+            !(textTimes ? readArchiveString(in, dateTime, byteLengths)
+                        : (bool)in.read((char *)&appt.dateTime.minutes, sizeof(appt.dateTime.minutes))))
+        {
+            *statusOut << "Archive segment " << segment.file << " is truncated." << endl;
+            break;
+        }
+        if (textTimes)
+            appt.dateTime = parseDateTime(dateTime);
+        if (code == 255)
+            readArchiveString(in, appt.status, byteLengths);
+        else if (code < (int)(sizeof(ARCHIVE_STATUSES) / sizeof(ARCHIVE_STATUSES[0])))
+            appt.status = ARCHIVE_STATUSES[code];
+        appt.isEmergency = emergency == 1;
+        if (!visit(appt))
+            return false;
+    }
+    return true;
+}
+
+// Streams the rows of every segment of a sealed month without caching them.
+// visit returns false to stop early; the result is false if it did.
+bool HospitalSystem::scanArchivedMonth(const string &month, const function<bool(const Appointment &)> &visit)
+{
+    for (const auto &segment : archiveCatalog)
+    {
+        if (segment.month == month && !scanSegment(segment, visit))
+            return false;
+    }
+    return true;
+}
+
+// Streams every archived row, oldest month first
+void HospitalSystem::scanArchive(const function<bool(const Appointment &)> &visit)
+{
+    set<string> months;
+    for (const auto &segment : archiveCatalog)
+    {
+        months.insert(segment.month);
+    }
+    for (const auto &month : months)
+    {
+        if (!scanArchivedMonth(month, visit))
+            return;
+    }
+}
+
+// Returns a sealed month's rows, keeping only the archiveCacheMonths most recently used
+// months in memory. The reference is valid until the next call.
+const vector<Appointment> &HospitalSystem::loadArchivedMonth(const string &month)
+{
+    auto loaded = loadedArchives.find(month);
+    if (loaded != loadedArchives.end())
+    {
+        archiveCacheOrder.erase(find(archiveCacheOrder.begin(), archiveCacheOrder.end(), month));
+    }
+    else
+    {
+        METRIC_TIMER("load_archived_month");
+        if (!archiveCacheOrder.empty() && archiveCacheOrder.size() >= max<size_t>(archiveCacheMonths, 1))
+        {
+            loadedArchives.erase(archiveCacheOrder.front());
+            archiveCacheOrder.pop_front();
+        }
+        loaded = loadedArchives.emplace(month, vector<Appointment>()).first;
+        vector<Appointment> &rows = loaded->second;
+        scanArchivedMonth(month, [&](const Appointment &appt)
+                          { rows.push_back(appt); return true; });
+    }
+    archiveCacheOrder.push_back(month);
+
+    // Trim after the limit was lowered; the month just used is last and stays
+    while (archiveCacheOrder.size() > max<size_t>(archiveCacheMonths, 1))
+    {
+        loadedArchives.erase(archiveCacheOrder.front());
+        archiveCacheOrder.pop_front();
+    }
+    return loaded->second;
+}
+
+// Looks in the hot window first, then in the month the appointment was booked for
+// (monthHint, -1 if unknown), then streams the other archived months newest first. Only
+// the patient's own appointment matches, in case an older tree reissued a sealed ID.
+bool HospitalSystem::findHistoricalAppointment(string apptID, string patientID, Appointment &found, int32_t monthHint)
+{
+    Appointment *hot = findAppointment(apptID);
+    if (hot && hot->patientID == patientID)
+    {
+        found = *hot;
+        return true;
+    }
+
+    set<string, greater<string>> months;
+    for (const auto &segment : archiveCatalog)
+    {
+        months.insert(segment.month);
+    }
+
+    string hinted = monthHint >= 0 ? formatMonth(monthHint) : "";
+    if (months.count(hinted))
+    {
+        for (const auto &appt : loadArchivedMonth(hinted))
+        {
+            if (appt.apptID == apptID && appt.patientID == patientID)
+            {
+                found = appt;
+                return true;
+            }
+        }
+    }
+
+    // The appointment may have moved month before it was sealed
+    bool match = false;
+    for (const auto &month : months)
+    {
+        if (month == hinted)
+            continue;
+        scanArchivedMonth(month, [&](const Appointment &appt)
+                          {
+                              if (appt.apptID != apptID || appt.patientID != patientID)
+                                  return true;
+                              found = appt;
+                              match = true;
+                              return false;
+                          });
+        if (match)
+            return true;
+    }
+    return false;
+}
+
+uint64_t MappedStore::checksum(const MappedHeader &h)
+{
+    MappedHeader layout = h;
+    layout.doctors.count = layout.patients.count = layout.appointments.count = layout.arena.count = 0;
+    layout.checkpoints = 0;
+    layout.layoutChecksum = 0;
+    layout.textStamp = 0;
+
+    // FNV-1a
+    uint64_t hash = 1469598103934665603ULL;
+    const unsigned char *bytes = (const unsigned char *)&layout;
+    size_t length = h.version < 3 ? offsetof(MappedHeader, textStamp) : sizeof(layout);
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Identifies the current doctors.txt, patients.txt and appointments.txt by size and
+// modification time; a missing file counts as empty
+uint64_t MappedStore::textStamp(const string &dataDir)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (const char *name : {"doctors.txt", "patients.txt", "appointments.txt"})
+    {
+        error_code ec;
+        int64_t parts[2] = {(int64_t)filesystem::file_size(dataDir + name, ec),
+                            (int64_t)filesystem::last_write_time(dataDir + name, ec).time_since_epoch().count()};
+        if (ec)
+            parts[0] = parts[1] = 0;
+        const unsigned char *bytes = (const unsigned char *)parts;
+        for (size_t i = 0; i < sizeof(parts); i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+string MappedStore::packSlots(const Doctor &doctor)
+{
+    return string((const char *)doctor.availableSlots.data(), doctor.availableSlots.size() * sizeof(SlotTime));
+}
+
+bool MappedStore::map(const string &file)
+{
+#if HS_HAVE_MMAP
+    unmap();
+    fd = ::open(file.c_str(), O_RDWR);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MappedHeader))
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    size = st.st_size;
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    base = (char *)addr;
+    return true;
+#else
+    (void)file;
+    return false;
+#endif
+}
+
+void MappedStore::unmap()
+{
+#if HS_HAVE_MMAP
+    if (base)
+        munmap(base, size);
+    if (fd >= 0)
+        ::close(fd);
+#endif
+    base = nullptr;
+    fd = -1;
+    size = 0;
+}
+
+bool MappedStore::put(const string &value, MappedStr &ref)
+{
+    MappedSection &arena = header()->arena;
+
+    // Unchanged strings keep their place in the arena
+    string current;
+    if (get(ref, current) && current == value)
+        return true;
+
+    if (arena.count + value.size() > arena.capacity)
+        return false;
+    memcpy(base + arena.offset + arena.count, value.data(), value.size());
+    ref = {(uint32_t)arena.count, (uint32_t)value.size()};
+    arena.count += value.size();
+    return true;
+}
+
+bool MappedStore::get(MappedStr ref, string &value)
+{
+    if ((uint64_t)ref.offset + ref.length > header()->arena.count)
+        return false;
+    value.assign(base + header()->arena.offset + ref.offset, ref.length);
+    return true;
+}
+
+bool MappedStore::putUser(MappedUser &rec, const User &user, const string &detail, const string &slots)
+{
+    return put(user.userID, rec.id) && put(user.name, rec.name) && put(user.password, rec.password) &&
+           put(detail, rec.detail) && put(slots, rec.slots);
+}
+
+bool MappedStore::putAppointment(MappedAppointment &rec, const Appointment &appt)
+{
+    rec.dateTime = appt.dateTime.minutes;
+    rec.emergency = appt.isEmergency ? 1 : 0;
+    return put(appt.apptID, rec.id) && put(appt.doctorID, rec.doctorID) && put(appt.patientID, rec.patientID) &&
+           put(appt.status, rec.status);
+}
+
+// Maps an existing state file and materializes the stores from it. Returns false if
+// the file is missing or fails validation, in which case the caller falls back to text.
+bool MappedStore::load(HospitalSystem &hospital)
+{
+    METRIC_TIMER("mapped_load");
+    owner = &hospital;
+    if (!map(path))
+        return false;
+
+    const MappedHeader &h = *header();
+    auto fits = [&](const MappedSection &section, uint64_t recordSize)
+    {
+        return section.count <= section.capacity && section.offset + section.capacity * recordSize <= size;
+    };
+    bool legacy = h.version < MAPPED_VERSION; // Read once, then rewritten in the current layout
+    bool textTimes = h.version == 1;
+    size_t appointmentSize = textTimes ? sizeof(MappedAppointmentV1) : sizeof(MappedAppointment);
+    size_t headerSize = legacy ? offsetof(MappedHeader, textStamp) : sizeof(MappedHeader);
+    bool valid = memcmp(h.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC)) == 0 && h.version >= 1 &&
+                 h.version <= MAPPED_VERSION && h.headerSize == headerSize &&
+                 h.userSize == sizeof(MappedUser) && h.appointmentSize == appointmentSize && h.fileSize == size &&
+                 h.layoutChecksum == checksum(h) && fits(h.doctors, sizeof(MappedUser)) &&
+                 fits(h.patients, sizeof(MappedUser)) && fits(h.appointments, appointmentSize) && fits(h.arena, 1);
+
+    // Text files written since this image last saw them (by a run without --state, or by
+    // hand) hold the newer data, so the image is rebuilt from them. Older versions carry
+    // no stamp and are trusted.
+    if (valid && !legacy && h.textStamp != textStamp(hospital.dataDir))
+    {
+        cerr << "WARNING: the text files changed after state file " << path << " was last written; "
+             << "rebuilding it from the text files." << endl;
+        unmap();
+        return false;
+    }
+
+    if (valid)
+        hospital.doctors.reserve(h.doctors.count); // Counts are only trusted once the header checks out
+    for (uint64_t i = 0; valid && i < h.doctors.count; i++)
+    {
+        const MappedUser &rec = *record<MappedUser>(h.doctors, i);
+        Doctor doctor;
+        doctor.role = "doctor";
+        string slots;
+        valid = get(rec.id, doctor.userID) && get(rec.name, doctor.name) && get(rec.password, doctor.password) &&
+                get(rec.detail, doctor.specialization) && get(rec.slots, slots);
+
+        // Slots were written from the sorted list, so they stay sorted
+        if (textTimes)
+        {
+            istringstream slotStream(slots);
+            string slot;
+            while (getline(slotStream, slot, ','))
+            {
+                SlotTime time = parseDateTime(slot);
+                if (time.valid())
+                    doctor.addAvailableSlot(time);
+                else if (!slot.empty())
+                    hospital.quarantine("doctors.txt", doctor.userID + "|" + slot);
+            }
+        }
+        else if ((valid = valid && slots.size() % sizeof(SlotTime) == 0))
+        {
+            doctor.availableSlots.resize(slots.size() / sizeof(SlotTime));
+            memcpy(doctor.availableSlots.data(), slots.data(), slots.size());
+        }
+        hospital.doctors.push_back(move(doctor));
+    }
+
+    if (valid)
+        hospital.patients.reserve(h.patients.count);
+    for (uint64_t i = 0; valid && i < h.patients.count; i++)
+    {
+        const MappedUser &rec = *record<MappedUser>(h.patients, i);
+        Patient patient;
+        patient.role = "patient";
+        valid = get(rec.id, patient.userID) && get(rec.name, patient.name) && get(rec.password, patient.password) &&
+                get(rec.detail, patient.medicalHistory);
+        hospital.patients.push_back(move(patient));
+    }
+
+    if (valid)
+        hospital.appointments.reserve(h.appointments.count);
+    for (uint64_t i = 0; valid && i < h.appointments.count; i++)
+    {
+        Appointment appt;
+        if (textTimes)
+        {
+            const MappedAppointmentV1 &rec = *record<MappedAppointmentV1>(h.appointments, i);
+            string dateTime;
+            valid = get(rec.id, appt.apptID) && get(rec.doctorID, appt.doctorID) &&
+                    get(rec.patientID, appt.patientID) && get(rec.dateTime, dateTime) && get(rec.status, appt.status);
+            appt.dateTime = parseDateTime(dateTime);
+            appt.isEmergency = rec.emergency != 0;
+            if (valid && !appt.dateTime.valid())
+            {
+                // Quarantined in the text row layout, as when loading text
+                hospital.quarantine("appointments.txt", appt.apptID + "|" + appt.doctorID + "|" + appt.patientID + "|" +
+                                                            dateTime + "|" + appt.status + "|" +
+                                                            (appt.isEmergency ? "1" : "0"));
+                continue;
+            }
+        }
+        else
+        {
+            const MappedAppointment &rec = *record<MappedAppointment>(h.appointments, i);
+            valid = get(rec.id, appt.apptID) && get(rec.doctorID, appt.doctorID) &&
+                    get(rec.patientID, appt.patientID) && get(rec.status, appt.status);
+            appt.dateTime.minutes = rec.dateTime;
+            appt.isEmergency = rec.emergency != 0;
+        }
+        hospital.appointments.push_back(move(appt));
+    }
+
+    if (!valid)
+    {
+        // Keep the bad file for inspection; a fresh one is built from the text files
+        cerr << "WARNING: state file " << path << " is invalid and was moved to " << path << ".invalid. "
+             << "Restoring from the text files; changes kept only in the state file are lost." << endl;
+        hospital.doctors.clear();
+        hospital.patients.clear();
+        hospital.appointments.clear();
+        unmap();
+        rename(path.c_str(), (path + ".invalid").c_str());
+        return false;
+    }
+
+    lastCheckpoint = time(0);
+    if (legacy)
+    {
+        create(hospital);
+    }
+    return true;
+}
+
+// Writes a fresh image of the hospital's stores with room to grow, then swaps it in
+void MappedStore::create(HospitalSystem &hospital)
+{
+#if HS_HAVE_MMAP
+    METRIC_TIMER("mapped_create");
+    owner = &hospital;
+
+    uint64_t strings = 0;
+    for (const auto &doctor : hospital.doctors)
+        strings += doctor.userID.size() + doctor.name.size() + doctor.password.size() + doctor.specialization.size() +
+                   packSlots(doctor).size();
+    for (const auto &patient : hospital.patients)
+        strings += patient.userID.size() + patient.name.size() + patient.password.size() + patient.medicalHistory.size();
+    for (const auto &appt : hospital.appointments)
+        strings += appt.apptID.size() + appt.doctorID.size() + appt.patientID.size() + appt.status.size();
+
+    MappedHeader h = {};
+    memcpy(h.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC));
+    h.version = MAPPED_VERSION;
+    h.headerSize = sizeof(MappedHeader);
+    h.userSize = sizeof(MappedUser);
+    h.appointmentSize = sizeof(MappedAppointment);
+    h.textStamp = textStamp(hospital.dataDir);
+
+    uint64_t offset = 4096; // Header page
+    auto layout = [&](MappedSection &section, uint64_t capacity, uint64_t recordSize)
+    {
+        section.offset = offset;
+        section.capacity = capacity;
+        offset += (capacity * recordSize + 4095) / 4096 * 4096;
+    };
+    layout(h.doctors, max<uint64_t>(256, hospital.doctors.size() * 2), sizeof(MappedUser));
+    layout(h.patients, max<uint64_t>(1024, hospital.patients.size() * 2), sizeof(MappedUser));
+    layout(h.appointments, max<uint64_t>(4096, hospital.appointments.size() * 2), sizeof(MappedAppointment));
+    layout(h.arena, min<uint64_t>(numeric_limits<uint32_t>::max(), strings * 2 + (1 << 20)), 1);
+    h.fileSize = offset;
+    h.layoutChecksum = checksum(h);
+
+    // Build the image next to the live file and rename it over, so a crash leaves one or the other
+    unmap();
+    string tmp = path + ".tmp";
+    fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    // Without an image nothing would persist, so the system reverts to saving text files
+    auto fail = [&](const char *what)
+    {
+        cerr << "WARNING: cannot " << what << " state file " << tmp << "; continuing with text files only." << endl;
+        unmap();
+        ::unlink(tmp.c_str());
+        rename(path.c_str(), (path + ".invalid").c_str()); // An older image must not win on restart
+        if (hospital.mappedStore == this)
+            hospital.mappedStore = nullptr;
+    };
+    if (fd < 0 || ftruncate(fd, h.fileSize) != 0)
+    {
+        fail("create");
+        return;
+    }
+    size = h.fileSize;
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        fail("map");
+        return;
+    }
+    base = (char *)addr;
+    *header() = h;
+
+    MappedHeader &live = *header();
+    for (const auto &doctor : hospital.doctors)
+        putUser(*record<MappedUser>(live.doctors, live.doctors.count++), doctor, doctor.specialization, packSlots(doctor));
+    for (const auto &patient : hospital.patients)
+        putUser(*record<MappedUser>(live.patients, live.patients.count++), patient, patient.medicalHistory, "");
+    for (const auto &appt : hospital.appointments)
+        putAppointment(*record<MappedAppointment>(live.appointments, live.appointments.count++), appt);
+
+    checkpoint();
+    rename(tmp.c_str(), path.c_str());
+
+    // Runs without --state must not work from the text files this image has outgrown
+    ofstream note(hospital.dataDir + "state_file.txt");
+    note << path << '\n';
+#else
+    (void)hospital;
+#endif
+}
+
+// Flushes the mapping to disk; runs automatically every checkpointEvery mutations or
+// checkpointSeconds seconds, and on every save
+void MappedStore::checkpoint()
+{
+#if HS_HAVE_MMAP
+    if (!base)
+        return;
+    METRIC_TIMER("mapped_checkpoint");
+    header()->checkpoints++;
+    msync(base, size, MS_SYNC);
+#endif
+    pendingMutations = 0;
+    lastCheckpoint = time(0);
+}
+
+// Records the text files just written from memory as matching this image
+void MappedStore::textWritten()
+{
+    if (!base)
+        return;
+    header()->textStamp = textStamp(owner->dataDir);
+    checkpoint();
+}
+
+void MappedStore::mutated()
+{
+    if (++pendingMutations >= checkpointEvery || time(0) - lastCheckpoint >= checkpointSeconds)
+        checkpoint();
+}
+
+// The in-memory stores already hold the change when these run, so when the image is
+// out of room it is simply rewritten from them
+void MappedStore::appendDoctor(const Doctor &doctor)
+{
+    if (!base)
+        return;
+    MappedSection &section = header()->doctors;
+    if (section.count < section.capacity &&
+        putUser(*record<MappedUser>(section, section.count), doctor, doctor.specialization, packSlots(doctor)))
+        section.count++;
+    else
+        create(*owner);
+    mutated();
+}
+
+void MappedStore::appendPatient(const Patient &patient)
+{
+    if (!base)
+        return;
+    MappedSection &section = header()->patients;
+    if (section.count < section.capacity &&
+        putUser(*record<MappedUser>(section, section.count), patient, patient.medicalHistory, ""))
+        section.count++;
+    else
+        create(*owner);
+    mutated();
+}
+
+void MappedStore::appendAppointment(const Appointment &appt)
+{
+    if (!base)
+        return;
+    MappedSection &section = header()->appointments;
+    if (section.count < section.capacity && putAppointment(*record<MappedAppointment>(section, section.count), appt))
+        section.count++;
+    else
+        create(*owner);
+    mutated();
+}
+
+void MappedStore::updateDoctor(size_t index, const Doctor &doctor)
+{
+    if (!base)
+        return;
+    MappedSection &section = header()->doctors;
+    if (index >= section.count ||
+        !putUser(*record<MappedUser>(section, index), doctor, doctor.specialization, packSlots(doctor)))
+        create(*owner);
+    mutated();
+}
+
+void MappedStore::updatePatient(size_t index, const Patient &patient)
+{
+    if (!base)
+        return;
+    MappedSection &section = header()->patients;
+    if (index >= section.count || !putUser(*record<MappedUser>(section, index), patient, patient.medicalHistory, ""))
+        create(*owner);
+    mutated();
+}
+
+void MappedStore::updateAppointment(size_t index, const Appointment &appt)
+{
+    if (!base)
+        return;
+    MappedSection &section = header()->appointments;
+    if (index >= section.count || !putAppointment(*record<MappedAppointment>(section, index), appt))
+        create(*owner);
+    mutated();
+}
+
+// Result of one batch command
+struct CommandResult
+{
+    bool ok;
+    string detail;
+};
+
+// Executes '|'-separated commands without the interactive menus, e.g.
+//   login|P1|secret
+//   book|D1|2025-04-05 10:00
+// Each command produces one result line: <line>|<command>|ok|<detail> or <line>|<command>|error|<message>.
+// A detail never contains '|': lists separate items with ';' and the fields of an item
+// with ',', and free text is percent-encoded (see encodeField).
+class CommandEngine
+{
+public:
+    explicit CommandEngine(HospitalSystem &hospital) : hospital(hospital) {}
+
+    CommandResult execute(const vector<string> &args);
+    size_t run(istream &in, ostream &out);
+
+private:
+    HospitalSystem &hospital;
+    string sessionUserID; // Stored by ID: user vectors may reallocate between commands
+    string sessionRole;
+
+    CommandResult requireRole(const string &role) const;
+    User *sessionUser();
+    static string encodeField(const string &text);
+    static string listAppointment(const Appointment &appt);
+};
+
+// Escapes the characters that structure a result line: % | ; , and line breaks
+string CommandEngine::encodeField(const string &text)
+{
+    static const char *hex = "0123456789ABCDEF";
+    string encoded;
+    for (unsigned char c : text)
+    {
+        if (c == '%' || c == '|' || c == ';' || c == ',' || c == '\n' || c == '\r')
+        {
+            encoded += '%';
+            encoded += hex[c >> 4];
+            encoded += hex[c & 15];
+        }
+        else
+        {
+            encoded += (char)c;
+        }
+    }
+    return encoded;
+}
+
+// "<apptID>,<doctorID>,<patientID>,<time>,<status>,<emergency 0|1>"
+string CommandEngine::listAppointment(const Appointment &appt)
+{
+    return encodeField(appt.apptID) + "," + encodeField(appt.doctorID) + "," + encodeField(appt.patientID) + "," +
+           formatDateTime(appt.dateTime) + "," + encodeField(appt.status) + "," + (appt.isEmergency ? "1" : "0");
+}
+
+User *CommandEngine::sessionUser()
+{
+    if (sessionRole == "doctor")
+        return hospital.findDoctor(sessionUserID);
+    if (sessionRole == "patient")
+        return hospital.findPatient(sessionUserID);
+    for (auto &admin : hospital.admins)
+    {
+        if (admin.userID == sessionUserID)
+            return &admin;
+    }
+    return nullptr;
+}
+
+CommandResult CommandEngine::requireRole(const string &role) const
+{
+    if (sessionUserID.empty())
+    {
+        return {false, "not logged in"};
+    }
+    if (sessionRole != role)
+    {
+        return {false, "requires " + role + " login"};
+    }
+    return {true, ""};
+}
+
+CommandResult CommandEngine::execute(const vector<string> &args)
+{
+    const string &cmd = args[0];
+    auto arity = [&](size_t n)
+    { return args.size() == n + 1; };
+
+    if (cmd == "login" && arity(2))
+    {
+        User *user = hospital.authenticateUser(args[1], args[2]);
+        if (!user)
+        {
+            return {false, "invalid credentials"};
+        }
+        sessionUserID = user->userID;
+        sessionRole = user->role;
+        hospital.logAudit("Logged in", sessionUserID);
+        return {true, sessionRole};
+    }
+    if (cmd == "logout" && arity(0))
+    {
+        if (sessionUserID.empty())
+        {
+            return {false, "not logged in"};
+        }
+        hospital.logAudit("Logged out", sessionUserID);
+        sessionUserID.clear();
+        sessionRole.clear();
+        return {true, ""};
+    }
+    if (cmd == "save" && arity(0))
+    {
+        hospital.saveToFile();
+        return {true, ""};
+    }
+    if (cmd == "password" && arity(2))
+    {
+        User *user = sessionUser();
+        if (!user)
+            return {false, "not logged in"};
+        if (!user->verifyPassword(args[1]))
+            return {false, "incorrect current password"};
+        user->password = hashPassword(args[2]);
+        hospital.persistUser(*user);
+        hospital.logAudit("Password changed", sessionUserID);
+        return {true, ""};
+    }
+
+    // Patient commands
+    if (cmd == "book" && arity(2))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        if (!hospital.findDoctor(args[1]))
+            return {false, "doctor not found"};
+        SlotTime slot = parseDateTime(args[2]);
+        if (!slot.isBookable())
+            return {false, "invalid slot time"};
+        Appointment *appt = hospital.bookAppointment(sessionUserID, args[1], slot);
+        return appt ? CommandResult{true, encodeField(appt->apptID)} : CommandResult{false, "slot not available"};
+    }
+    if (cmd == "cancel" && arity(1))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        return hospital.cancelAppointment(sessionUserID, args[1], "patient-cancelled")
+                   ? CommandResult{true, encodeField(args[1])}
+                   : CommandResult{false, "appointment not found or cannot be cancelled"};
+    }
+    if (cmd == "reschedule" && arity(2))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        Appointment *appt = hospital.findAppointment(args[1]);
+        if (!appt || appt->patientID != sessionUserID || appt->status != "scheduled")
+            return {false, "appointment not found or cannot be rescheduled"};
+        SlotTime slot = parseDateTime(args[2]);
+        if (!slot.isBookable())
+            return {false, "invalid slot time"};
+        return hospital.rescheduleAppointment(args[1], args[2]) ? CommandResult{true, formatDateTime(slot)}
+                                                                : CommandResult{false, "slot not available"};
+    }
+    if (cmd == "emergency" && arity(0))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        Appointment *appt = hospital.requestEmergency(sessionUserID);
+        return appt ? CommandResult{true, encodeField(appt->apptID) + "," + encodeField(appt->doctorID)}
+                    : CommandResult{false, "no doctors on emergency duty"};
+    }
+    if (cmd == "waitlist" && arity(2))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        return hospital.joinWaitlist(sessionUserID, args[1], args[2]) ? CommandResult{true, encodeField(args[1])}
+                                                                      : CommandResult{false, "cannot join waitlist"};
+    }
+    if (cmd == "leaveWaitlist" && arity(1))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        int removed = hospital.withdrawFromWaitlist(sessionUserID, args[1]);
+        return removed ? CommandResult{true, to_string(removed)} : CommandResult{false, "not on this waitlist"};
+    }
+    if (cmd == "find" && arity(3))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        SlotTime after = parseDateTime(args[2]);
+        if (!after.valid())
+            return {false, "invalid date and time"};
+        vector<SlotOffer> offers = hospital.findEarliestSlots(args[1], after, strtoul(args[3].c_str(), nullptr, 10));
+        string detail;
+        for (const auto &offer : offers)
+        {
+            detail += (detail.empty() ? "" : ";") + encodeField(offer.doctorID) + "," + formatDateTime(offer.dateTime);
+        }
+        return {true, detail};
+    }
+    if (cmd == "records" && arity(0))
+    {
+        CommandResult check = requireRole("patient");
+        if (!check.ok)
+            return check;
+        // Medical history first, then one item per appointment
+        Patient *patient = hospital.findPatient(sessionUserID);
+        string detail = encodeField(patient->medicalHistory);
+        for (const auto &ref : patient->appointmentRefs)
+        {
+            Appointment appt;
+            if (hospital.findHistoricalAppointment(ref.apptID, sessionUserID, appt, ref.month))
+                detail += ";" + listAppointment(appt);
+        }
+        hospital.logAudit("Viewed medical records", sessionUserID);
+        return {true, detail};
+    }
+
+    // Doctor commands
+    if (cmd == "appointments" && arity(0))
+    {
+        CommandResult check = requireRole("doctor");
+        if (!check.ok)
+            return check;
+        string detail;
+        hospital.scanArchive([&](const Appointment &appt)
+                             {
+                                 if (appt.doctorID == sessionUserID)
+                                     detail += (detail.empty() ? "" : ";") + listAppointment(appt);
+                                 return true;
+                             });
+        for (const auto &appt : hospital.appointments)
+        {
+            if (appt.doctorID == sessionUserID)
+                detail += (detail.empty() ? "" : ";") + listAppointment(appt);
+        }
+        return {true, detail};
+    }
+    if (cmd == "history" && arity(1))
+    {
+        CommandResult check = requireRole("doctor");
+        if (!check.ok)
+            return check;
+        Patient *patient = hospital.findPatient(args[1]);
+        if (!patient)
+            return {false, "patient not found"};
+        hospital.logAudit("Viewed patient history: " + args[1], sessionUserID);
+        return {true, encodeField(patient->medicalHistory)};
+    }
+    if (cmd == "availability" && arity(1))
+    {
+        CommandResult check = requireRole("doctor");
+        if (!check.ok)
+            return check;
+        SlotTime slot = parseDateTime(args[1]);
+        if (!slot.isBookable())
+            return {false, "invalid slot time"};
+        Doctor *doctor = hospital.findDoctor(sessionUserID);
+        doctor->addAvailableSlot(slot);
+        hospital.persistUser(*doctor);
+        hospital.logAudit("Updated availability", sessionUserID);
+        return {true, formatDateTime(slot)};
+    }
+    if (cmd == "markEmergency" && arity(0))
+    {
+        CommandResult check = requireRole("doctor");
+        if (!check.ok)
+            return check;
+        return {true, to_string(hospital.findDoctor(sessionUserID)->declareEmergency())};
+    }
+
+    // Admin commands
+    if (cmd == "addDoctor" && arity(4))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        if (!hospital.registerDoctor(Doctor(args[1], args[2], args[4], args[3])))
+            return {false, "doctor already exists"};
+        hospital.logAudit("Added doctor: " + args[1], sessionUserID);
+        return {true, encodeField(args[1])};
+    }
+    if (cmd == "addPatient" && arity(4))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        if (!hospital.registerPatient(Patient(args[1], args[2], args[4], args[3])))
+            return {false, "patient already exists"};
+        hospital.logAudit("Added patient: " + args[1], sessionUserID);
+        return {true, encodeField(args[1])};
+    }
+    if (cmd == "override" && arity(1))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        Doctor *doctor = hospital.findDoctor(args[1]);
+        if (!doctor)
+            return {false, "doctor not found"};
+        return {true, to_string(doctor->declareEmergency())};
+    }
+    if (cmd == "report" && arity(0))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        AppointmentStats stats = hospital.computeStats();
+        hospital.logAudit("Generated report", sessionUserID);
+        return {true, "doctors=" + to_string(hospital.doctors.size()) + ",patients=" + to_string(hospital.patients.size()) +
+                          ",appointments=" + to_string(stats.total) +
+                          ",archived=" + to_string(stats.total - hospital.appointments.size()) +
+                          ",scheduled=" + to_string(stats.scheduled) + ",completed=" + to_string(stats.completed) +
+                          ",cancelled=" + to_string(stats.cancelled) + ",emergency=" + to_string(stats.emergency)};
+    }
+    if (cmd == "backup" && arity(0))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        return {true, encodeField(hospital.backupData())};
+    }
+
+    if (cmd == "archive" && arity(0))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        return {true, to_string(hospital.sealClosedPartitions())};
+    }
+    if (cmd == "metrics" && arity(0))
+    {
+        CommandResult check = requireRole("admin");
+        if (!check.ok)
+            return check;
+        return hospital.exportMetrics(nullptr) ? CommandResult{true, encodeField(hospital.dataDir + "metrics.prom")}
+                                               : CommandResult{false, "metrics disabled in this build"};
+    }
+
+    return {false, "unknown command or wrong number of arguments"};
+}
+
+// Runs every command in the stream and returns the number that failed
+size_t CommandEngine::run(istream &in, ostream &out)
+{
+    hospital.auditAutoFlush = false;
+
+    size_t lineNo = 0, failures = 0;
+    string line;
+    while (getline(in, line))
+    {
+        lineNo++;
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        vector<string> args;
+        istringstream iss(line);
+        string field;
+        while (getline(iss, field, '|'))
+        {
+            args.push_back(field);
+        }
+        if (line.back() == '|')
+        {
+            args.push_back("");
+        }
+
+        CommandResult result = execute(args);
+        if (!result.ok)
+        {
+            failures++;
+        }
+        out << lineNo << "|" << args[0] << "|" << (result.ok ? "ok" : "error") << "|" << result.detail << '\n';
+    }
+
+    out.flush();
+    hospital.auditFile.flush();
+    hospital.auditAutoFlush = true;
+    return failures;
+}
+
+// Main function
+#ifndef HS_NO_MAIN
+int main(int argc, char *argv[])
+{
+    srand(time(0)); // Seed for random numbers
+
+    // Options:
+    //   --state <file>                         keep live data in a memory-mapped state file
+    //   --batch <commands file | -> [results]  run batch commands instead of the menus
+    string statePath, batchInput, batchOutput;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--state" && i + 1 < argc)
+        {
+            statePath = argv[++i];
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            batchInput = argv[++i];
+            if (i + 1 < argc && string(argv[i + 1]).rfind("--", 0) != 0)
+                batchOutput = argv[++i];
+        }
+        else
+        {
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+
+    HospitalSystem hospital;
+    if (!batchInput.empty())
+    {
+        hospital.statusOut = &cerr; // Keep the result stream machine-readable
+    }
+    unique_ptr<MappedStore> store;
+    string heldIn;
+    if (statePath.empty() && getline(ifstream(hospital.dataDir + "state_file.txt"), heldIn) &&
+        filesystem::exists(heldIn))
+    {
+        // The text files trail that state file, so working from them would lose its changes
+        cerr << "The data is kept in state file " << heldIn << "; run with --state " << heldIn << "." << endl;
+        return 1;
+    }
+    if (!statePath.empty())
+    {
+        if (!HS_HAVE_MMAP)
+        {
+            cerr << "Memory-mapped state is not supported on this platform." << endl;
+            return 1;
+        }
+        store.reset(new MappedStore(statePath));
+        hospital.mappedStore = store.get();
+    }
+    hospital.loadFromFile();
+
+    // Patient notifications are delivered in the background to notifications.log
+    FileNotificationSink notificationSink(hospital.dataDir + "notifications.log");
+    NotificationService notifications(notificationSink);
+    notifications.start();
+    hospital.notifier = &notifications;
+
+    // Batch mode
+    if (!batchInput.empty())
+    {
+        ifstream cmdFile;
+        istream *in = &cin;
+        if (batchInput != "-")
+        {
+            cmdFile.open(batchInput);
+            if (!cmdFile.is_open())
+            {
+                cerr << "Cannot open command file: " << batchInput << endl;
+                return 1;
+            }
+            in = &cmdFile;
+        }
+
+        ofstream resultFile;
+        ostream *out = &cout;
+        if (!batchOutput.empty())
+        {
+            resultFile.open(batchOutput);
+            out = &resultFile;
+        }
+
+        CommandEngine engine(hospital);
+        size_t failures = engine.run(*in, *out);
+        notifications.stop();
+        hospital.saveToFile();
+        hospital.exportMetrics(nullptr);
+        return failures == 0 ? 0 : 2;
+    }
 
     int choice;
     do
@@ -856,8 +3890,11 @@ int main()
         }
     } while (choice != 2);
 
+    notifications.stop();
     hospital.saveToFile();
+    hospital.exportMetrics(nullptr);
     cout << "Goodbye!" << endl;
 
     return 0;
 }
+#endif // HS_NO_MAIN
@@ -0,0 +1,546 @@
+// Benchmarks for the hospital scheduling system.
+// Build: g++ -std=c++17 -O2 HS_bench.cpp -o hs_bench
+// Usage: hs_bench [small|medium|large|doctors ...]   (default: small medium doctors)
+//
+// Each scale generates a synthetic hospital in bench_data_<scale>/ using the regular
+// doctors.txt / patients.txt / appointments.txt formats, then times the core
+// HospitalSystem operations against it. "doctors" instead sweeps findEarliestSlots
+// over 1k, 4k and 16k in-memory doctors against the full scan. Results go to stdout
+// as one JSON object per line; progress goes to stderr.
+#define HS_NO_MAIN
+#include "HS.cpp"
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+
+struct BenchScale
+{
+    string name;
+    int doctors;
+    int patients;
+    int appointments;
+};
+
+static const BenchScale SCALES[] = {
+    {"small", 200, 2000, 20000},
+    {"medium", 1000, 20000, 200000},
+    {"large", 5000, 100000, 1000000},
+};
+
+// Specializations with rough relative staffing weights
+static const pair<const char *, int> SPECIALIZATIONS[] = {
+    {"General", 30}, {"Pediatrics", 12}, {"Cardiology", 10}, {"Orthopedics", 10}, {"Neurology", 8},
+    {"Dermatology", 8}, {"Oncology", 6}, {"Radiology", 6}, {"Psychiatry", 5}, {"Ophthalmology", 5},
+};
+
+static const int SLOTS_PER_DAY = 18; // 08:00 - 16:30 in half-hour slots
+static const int HISTORY_DAYS = 180;
+static const int FUTURE_DAYS = 30;
+static const int AVAILABILITY_DAYS = 5;
+
+// Swallows output from the menu-facing methods while they are being timed
+struct NullBuffer : streambuf
+{
+    int overflow(int c) override { return c; }
+};
+
+// "YYYY-MM-DD HH:MM" for a day relative to today and a slot within that day
+string slotTime(int dayOffset, int slot)
+{
+    tm day = localTime(time(0));
+    day.tm_mday += dayOffset;
+    day.tm_hour = 8 + slot / 2;
+    day.tm_min = (slot % 2) * 30;
+    day.tm_sec = 0;
+    day.tm_isdst = -1;
+    mktime(&day);
+
+    char buf[20];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &day);
+    return buf;
+}
+
+// Writes a synthetic hospital into dir in the on-disk formats loadFromFile reads
+void generateHospital(const string &dir, const BenchScale &scale, unsigned seed)
+{
+    mt19937 rng(seed);
+    filesystem::remove_all(dir); // Includes any archive sealed by a previous run
+    filesystem::create_directories(dir);
+
+    vector<int> weights;
+    for (const auto &spec : SPECIALIZATIONS)
+        weights.push_back(spec.second);
+    discrete_distribution<int> pickSpec(weights.begin(), weights.end());
+
+    ofstream docFile(dir + "doctors.txt");
+    for (int d = 0; d < scale.doctors; d++)
+    {
+        docFile << "D" << d << "|Doctor " << d << "|" << SPECIALIZATIONS[pickSpec(rng)].first << "|"
+                << hashPassword("dpw" + to_string(d)) << "|";
+        bool first = true;
+        for (int day = 1; day <= AVAILABILITY_DAYS; day++)
+        {
+            for (int slot = 0; slot < SLOTS_PER_DAY; slot++)
+            {
+                // Doctors are available for roughly three quarters of their working slots
+                if (rng() % 4 != 0)
+                {
+                    docFile << (first ? "" : ",") << slotTime(day, slot);
+                    first = false;
+                }
+            }
+        }
+        docFile << "\n";
+    }
+
+    static const char *HISTORIES[] = {"None", "Hypertension", "Type 2 diabetes", "Asthma", "Allergies: penicillin",
+                                      "Previous fracture", "Migraine"};
+    ofstream patFile(dir + "patients.txt");
+    for (int p = 0; p < scale.patients; p++)
+    {
+        patFile << "P" << p << "|Patient " << p << "|" << HISTORIES[rng() % 7] << "|"
+                << hashPassword("ppw" + to_string(p)) << "\n";
+    }
+
+    // Most appointments are history, some are upcoming, a few are today
+    uniform_int_distribution<int> pickDoctor(0, scale.doctors - 1);
+    uniform_int_distribution<int> pickPatient(0, scale.patients - 1);
+    uniform_int_distribution<int> pickSlot(0, SLOTS_PER_DAY - 1);
+    uniform_int_distribution<int> pickPast(-HISTORY_DAYS, -1);
+    uniform_int_distribution<int> pickFuture(1, FUTURE_DAYS);
+    uniform_int_distribution<int> percent(0, 99);
+
+    // Slot strings are cached per day since strftime dominates otherwise
+    map<int, vector<string>> dayCache;
+    auto cachedSlot = [&](int day, int slot) -> const string &
+    {
+        vector<string> &slots = dayCache[day];
+        if (slots.empty())
+        {
+            for (int s = 0; s < SLOTS_PER_DAY; s++)
+                slots.push_back(slotTime(day, s));
+        }
+        return slots[slot];
+    };
+
+    set<pair<int, long>> taken; // (doctor, day * SLOTS_PER_DAY + slot)
+    ofstream apptFile(dir + "appointments.txt");
+    for (int a = 0; a < scale.appointments; a++)
+    {
+        int roll = percent(rng);
+        int day = roll < 5 ? 0 : roll < 80 ? pickPast(rng) : pickFuture(rng);
+        int doctor, slot;
+        do
+        {
+            doctor = pickDoctor(rng);
+            slot = pickSlot(rng);
+        } while (!taken.insert({doctor, (long)day * SLOTS_PER_DAY + slot}).second);
+
+        string status;
+        int s = percent(rng);
+        if (day < 0)
+            status = s < 80 ? "completed" : s < 92 ? "patient-cancelled" : s < 95 ? "cancelled" : s < 97 ? "emergency-cancelled" : "scheduled";
+        else
+            status = s < 90 ? "scheduled" : "patient-cancelled";
+
+        apptFile << "A" << a << "|D" << doctor << "|P" << pickPatient(rng) << "|" << cachedSlot(day, slot) << "|"
+                 << status << "|" << (percent(rng) < 2 ? "1" : "0") << "\n";
+    }
+}
+
+// Latency samples for one operation, reported as percentiles and throughput
+struct BenchRecorder
+{
+    string scale;
+    vector<double> samples; // microseconds
+    double totalMicros = 0;
+
+    explicit BenchRecorder(const string &scale) : scale(scale) {}
+
+    template <typename F>
+    void time(F fn)
+    {
+        auto start = chrono::steady_clock::now();
+        fn();
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        samples.push_back(us);
+        totalMicros += us;
+    }
+
+    void report(const string &bench)
+    {
+        sort(samples.begin(), samples.end());
+        auto pct = [&](double p)
+        { return samples[min(samples.size() - 1, (size_t)(p * samples.size()))]; };
+        cout << fixed << setprecision(3) << "{\"bench\":\"" << bench << "\",\"scale\":\"" << scale
+             << "\",\"ops\":" << samples.size() << ",\"p50_us\":" << pct(0.50) << ",\"p90_us\":" << pct(0.90)
+             << ",\"p99_us\":" << pct(0.99) << ",\"max_us\":" << samples.back()
+             << ",\"ops_per_sec\":" << samples.size() / (totalMicros / 1e6) << "}" << endl;
+        samples.clear();
+        totalMicros = 0;
+    }
+};
+
+// Reference answer for findEarliestSlots: check every slot of every matching doctor
+vector<SlotOffer> scanEarliestSlots(HospitalSystem &hospital, const string &specialization, SlotTime after, size_t count)
+{
+    vector<SlotOffer> all;
+    for (const auto &doctor : hospital.doctors)
+    {
+        if (doctor.specialization != specialization)
+            continue;
+        for (const auto &slot : doctor.availableSlots)
+        {
+            if (slot >= after && hospital.isSlotAvailable(doctor.userID, slot))
+                all.push_back({doctor.userID, slot});
+        }
+    }
+    sort(all.begin(), all.end(), [&](const SlotOffer &a, const SlotOffer &b)
+         { return a.dateTime != b.dateTime ? a.dateTime < b.dateTime
+                                           : hospital.doctorIndex[a.doctorID] < hospital.doctorIndex[b.doctorID]; });
+    if (all.size() > count)
+        all.resize(count);
+    return all;
+}
+
+// findEarliestSlots against the full scan as the doctor count grows. Bookings are
+// claimed straight into the slot index, so no appointment records are built.
+void runDoctorSweep()
+{
+    const int doctorCounts[] = {1000, 4000, 16000};
+    const size_t specCount = sizeof(SPECIALIZATIONS) / sizeof(SPECIALIZATIONS[0]);
+    mt19937 rng(11);
+    size_t sink = 0;
+    for (int doctorCount : doctorCounts)
+    {
+        cerr << "Sweeping findEarliestSlots over " << doctorCount << " doctors" << endl;
+        HospitalSystem hospital;
+        for (int d = 0; d < doctorCount; d++)
+        {
+            Doctor doctor("D" + to_string(d), "Doctor " + to_string(d), "pwd", SPECIALIZATIONS[d % specCount].first);
+            for (int day = 1; day <= AVAILABILITY_DAYS; day++)
+            {
+                for (int slot = 0; slot < SLOTS_PER_DAY; slot++)
+                    doctor.availableSlots.push_back(parseDateTime(slotTime(day, slot)));
+            }
+            hospital.registerDoctor(doctor);
+        }
+        for (const auto &doctor : hospital.doctors)
+        {
+            for (SlotTime slot : doctor.availableSlots)
+            {
+                if (rng() % 5 != 0) // Four in five slots are taken
+                    hospital.claimSlot(doctor.userID, slot);
+            }
+        }
+
+        SlotTime after = parseDateTime(slotTime(2, 4));
+        for (size_t s = 0; s < specCount; s++)
+        {
+            auto fast = hospital.findEarliestSlots(SPECIALIZATIONS[s].first, after, 10);
+            auto slow = scanEarliestSlots(hospital, SPECIALIZATIONS[s].first, after, 10);
+            bool same = fast.size() == slow.size();
+            for (size_t i = 0; same && i < fast.size(); i++)
+                same = fast[i].doctorID == slow[i].doctorID && fast[i].dateTime == slow[i].dateTime;
+            if (!same)
+            {
+                cerr << "findEarliestSlots disagrees with full scan at " << doctorCount << " doctors" << endl;
+                exit(1);
+            }
+        }
+
+        BenchRecorder rec("doctors_" + to_string(doctorCount));
+        const size_t ks[] = {1, 10};
+        for (size_t k : ks)
+        {
+            for (int merged = 1; merged >= 0; merged--)
+            {
+                for (int i = 0; i < (merged ? 2000 : 20); i++)
+                {
+                    const char *spec = SPECIALIZATIONS[rng() % specCount].first;
+                    SlotTime from = parseDateTime(slotTime(1 + rng() % AVAILABILITY_DAYS, rng() % SLOTS_PER_DAY));
+                    rec.time([&]()
+                             { sink += merged ? hospital.findEarliestSlots(spec, from, k).size()
+                                              : scanEarliestSlots(hospital, spec, from, k).size(); });
+                }
+                rec.report(string(merged ? "findEarliestSlots" : "scanEarliestSlots") + "_k" + to_string(k));
+            }
+        }
+    }
+    cerr << "Done doctors (check " << sink << ")" << endl;
+}
+
+void runScale(const BenchScale &scale)
+{
+    string dir = "bench_data_" + scale.name + "/";
+    cerr << "Generating " << scale.name << ": " << scale.doctors << " doctors, " << scale.patients << " patients, "
+         << scale.appointments << " appointments" << endl;
+    generateHospital(dir, scale, 42);
+
+    NullBuffer nullBuffer;
+    streambuf *console = cout.rdbuf();
+    auto mute = [&]()
+    { cout.rdbuf(&nullBuffer); };
+    auto unmute = [&]()
+    { cout.rdbuf(console); };
+
+    mt19937 rng(7);
+    BenchRecorder rec(scale.name);
+
+    // The first load seals closed months out of appointments.txt; do it untimed so
+    // every timed run below loads the same data
+    {
+        HospitalSystem warmup;
+        warmup.dataDir = dir;
+        mute();
+        warmup.loadFromFile();
+        unmute();
+    }
+
+    // loadFromFile: a fresh system per run
+    for (int i = 0; i < 5; i++)
+    {
+        HospitalSystem fresh;
+        fresh.dataDir = dir;
+        mute();
+        rec.time([&]()
+                 { fresh.loadFromFile(); });
+        unmute();
+    }
+    rec.report("loadFromFile");
+
+    // Restart from a memory-mapped state file; the first load builds it from the text files
+    string statePath = dir + "live.state";
+    for (int i = 0; i < 6; i++)
+    {
+        HospitalSystem fresh;
+        fresh.dataDir = dir;
+        MappedStore store(statePath);
+        fresh.mappedStore = &store;
+        mute();
+        if (i == 0)
+            fresh.loadFromFile();
+        else
+            rec.time([&]()
+                     { fresh.loadFromFile(); });
+        unmute();
+        if (fresh.appointments.empty())
+        {
+            cerr << "Mapped restart lost the appointments" << endl;
+            exit(1);
+        }
+    }
+    rec.report("loadFromFile_mapped");
+
+    HospitalSystem hospital;
+    hospital.dataDir = dir;
+    mute();
+    hospital.loadFromFile();
+    unmute();
+
+    // Notifications flow for every operation below, as in the real program
+    FileNotificationSink notificationSink(dir + "notifications.log");
+    NotificationService notifications(notificationSink);
+    notifications.start();
+    hospital.notifier = &notifications;
+
+    // saveToFile
+    for (int i = 0; i < 5; i++)
+    {
+        mute();
+        rec.time([&]()
+                 { hospital.saveToFile(); });
+        unmute();
+    }
+    rec.report("saveToFile");
+
+    // isSlotAvailable: half booked slots, half random ones
+    size_t sink = 0;
+    for (int i = 0; i < 100000; i++)
+    {
+        string doctorID;
+        SlotTime dateTime;
+        if (i % 2 == 0)
+        {
+            const Appointment &appt = hospital.appointments[rng() % hospital.appointments.size()];
+            doctorID = appt.doctorID;
+            dateTime = appt.dateTime;
+        }
+        else
+        {
+            doctorID = "D" + to_string(rng() % scale.doctors);
+            dateTime = parseDateTime(slotTime(0, rng() % SLOTS_PER_DAY));
+        }
+        rec.time([&]()
+                 { sink += hospital.isSlotAvailable(doctorID, dateTime); });
+    }
+    rec.report("isSlotAvailable");
+
+    // Time parsing and formatting at the input and output boundaries
+    vector<string> texts;
+    for (int i = 0; i < 1000; i++)
+    {
+        string text = slotTime(rng() % AVAILABILITY_DAYS, rng() % SLOTS_PER_DAY);
+        // Every other input drops the zero padding, e.g. "2025-4-5 9:00"
+        for (size_t pos = text.size() - 1; i % 2 && pos > 0; pos--)
+        {
+            if (text[pos] == '0' && (text[pos - 1] == '-' || text[pos - 1] == ' ') && isdigit(text[pos + 1]))
+                text.erase(pos, 1);
+        }
+        texts.push_back(text);
+    }
+    for (int i = 0; i < 100000; i++)
+    {
+        const string &text = texts[i % texts.size()];
+        rec.time([&]()
+                 { sink += parseDateTime(text).valid(); });
+    }
+    rec.report("parseDateTime");
+    char formatted[16];
+    for (int i = 0; i < 100000; i++)
+    {
+        SlotTime time = hospital.appointments[i % hospital.appointments.size()].dateTime;
+        rec.time([&]()
+                 { formatDateTime(time, formatted); sink += formatted[15]; });
+    }
+    rec.report("formatDateTime");
+
+    // authenticateUser: doctors, patients and wrong passwords
+    for (int i = 0; i < 2000; i++)
+    {
+        string userID, password;
+        int kind = rng() % 5;
+        if (kind < 2)
+        {
+            int d = rng() % scale.doctors;
+            userID = "D" + to_string(d);
+            password = "dpw" + to_string(d);
+        }
+        else
+        {
+            int p = rng() % scale.patients;
+            userID = "P" + to_string(p);
+            password = kind < 4 ? "ppw" + to_string(p) : "wrong";
+        }
+        rec.time([&]()
+                 { sink += hospital.authenticateUser(userID, password) != nullptr; });
+    }
+    rec.report("authenticateUser");
+
+    // findEarliestSlots, checked against a full scan first
+    SlotTime after = parseDateTime(slotTime(2, 4));
+    for (const auto &spec : SPECIALIZATIONS)
+    {
+        auto fast = hospital.findEarliestSlots(spec.first, after, 10);
+        auto slow = scanEarliestSlots(hospital, spec.first, after, 10);
+        bool same = fast.size() == slow.size();
+        for (size_t i = 0; same && i < fast.size(); i++)
+            same = fast[i].doctorID == slow[i].doctorID && fast[i].dateTime == slow[i].dateTime;
+        if (!same)
+        {
+            cerr << "findEarliestSlots disagrees with full scan for " << spec.first << endl;
+            exit(1);
+        }
+    }
+    const size_t ks[] = {1, 10};
+    for (size_t k : ks)
+    {
+        for (int i = 0; i < 2000; i++)
+        {
+            const char *spec = SPECIALIZATIONS[rng() % (sizeof(SPECIALIZATIONS) / sizeof(SPECIALIZATIONS[0]))].first;
+            SlotTime from = parseDateTime(slotTime(1 + rng() % AVAILABILITY_DAYS, rng() % SLOTS_PER_DAY));
+            rec.time([&]()
+                     { sink += hospital.findEarliestSlots(spec, from, k).size(); });
+        }
+        rec.report("findEarliestSlots_k" + to_string(k));
+    }
+
+    // generateReports
+    Admin admin("bench-admin", "Bench Admin", "x");
+    for (int i = 0; i < 20; i++)
+    {
+        mute();
+        rec.time([&]()
+                 { admin.generateReports(); });
+        unmute();
+    }
+    rec.report("generateReports");
+
+    // cancelAppointment with waitlist backfill: half of the upcoming appointments wait
+    // for an earlier slot, the other half are cancelled
+    vector<pair<string, string>> upcoming; // (apptID, patientID)
+    SlotTime now = currentSlotTime();
+    for (const auto &appt : hospital.appointments)
+    {
+        if (appt.status == "scheduled" && appt.dateTime > now && upcoming.size() < 4000)
+            upcoming.push_back({appt.apptID, appt.patientID});
+    }
+    for (size_t i = 0; i < upcoming.size(); i += 2)
+    {
+        hospital.joinWaitlist(upcoming[i].second, hospital.findAppointment(upcoming[i].first)->doctorID, upcoming[i].first);
+    }
+    for (size_t i = 1; i < upcoming.size(); i += 2)
+    {
+        rec.time([&]()
+                 { sink += hospital.cancelAppointment(upcoming[i].second, upcoming[i].first, "patient-cancelled"); });
+    }
+    rec.report("cancelAppointment_backfill");
+
+    // markEmergency: each run takes a different doctor off today's schedule
+    for (int d = 0; d < min(scale.doctors, 200); d++)
+    {
+        Doctor *doctor = hospital.findDoctor("D" + to_string(d));
+        mute();
+        rec.time([&]()
+                 { doctor->markEmergency(); });
+        unmute();
+    }
+    rec.report("markEmergency");
+
+    // Raw publish cost; producers must not wait on the workers even when the queue fills
+    Notification note{"P0", "booked", "A0", parseDateTime(slotTime(1, 0)), {}};
+    for (int i = 0; i < 100000; i++)
+    {
+        rec.time([&]()
+                 { notifications.publish(note); });
+    }
+    rec.report("notificationPublish");
+
+    notifications.stop();
+    cerr << "Notifications: " << notifications.published << " published, " << notifications.delivered
+         << " delivered, " << notifications.dropped << " dropped" << endl;
+
+    hospital.auditFile.flush();
+    cerr << "Done " << scale.name << " (check " << sink << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<string> selected;
+    for (int i = 1; i < argc; i++)
+        selected.push_back(argv[i]);
+    if (selected.empty())
+        selected = {"small", "medium", "doctors"};
+
+    for (const string &name : selected)
+    {
+        bool found = name == "doctors";
+        if (found)
+            runDoctorSweep();
+        for (const auto &scale : SCALES)
+        {
+            if (scale.name == name)
+            {
+                runScale(scale);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            cerr << "Unknown scale: " << name << endl;
+            return 1;
+        }
+    }
+    return 0;
+}